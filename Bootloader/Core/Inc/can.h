@@ -11,8 +11,6 @@
 
 /* Defines -------------------------------------------------------------------*/
 
-static const uint8_t DLCtoBytes[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
-
 
 /*----------------------------------------------------
 For Clock 8MHz
@@ -29,12 +27,26 @@ For Clock 32MHz
 -----------------------------------------------------*/
 
 
+/*----------------------------------------------------
+CAN-FD data phase (bit rate switching), Clock 32MHz
+2000 kbit/sec DSEG1 - 11; DSEG2 - 4; DBRP - 1;  <--current
+4000 kbit/sec DSEG1 - 5; DSEG2 - 2; DBRP - 1;
+-----------------------------------------------------*/
+
+
 /* CAN1 settings values ------------------------------------------------------*/
 #define CAN1_NSJW 								(1U)
 #define CAN1_NTSEG1 							(13U)
 #define CAN1_NTSEG2 							(2U)
 #define CAN1_NBRP 								(4U)
 
+/* CAN1 data phase settings values (CAN-FD with bit rate switching) ----------*/
+#define CAN1_DSJW 								(4U)
+#define CAN1_DTSEG1 							(11U)
+#define CAN1_DTSEG2 							(4U)
+#define CAN1_DBRP 								(1U)
+#define CAN1_TDCO 								((1U + CAN1_DTSEG1) * CAN1_DBRP)	// transmitter delay compensation offset, mtq
+
 /* CAN2 settings values ------------------------------------------------------*/
 #define CAN2_NSJW 								(2U)
 #define CAN2_NTSEG1 							(10U)
@@ -44,16 +56,22 @@ For Clock 32MHz
 /* CAN1 and CAN2 share the same message RAM -> general parameters for Tx & Rx  */
 #define CAN_RX_STD_FILT_NBR 					(32U) //maximum value 128
 #define CAN_RX_EXT_FILT_NBR 					(0U)
-#define CAN_RX_FIFO0_ELMTS_NBR 					(0U)
+#define CAN_RX_FIFO0_ELMTS_NBR 					(64U) //all Rx msgs go to FIFO 0, so they are read in order of reception (maximum value 64)
+#define CAN_RX_FIFO0_WATERMARK 					(32U) //interrupt when FIFO 0 fill level reaches this value
 #define CAN_RX_FIFO1_ELMTS_NBR 					(0U)
-#define	CAN_RX_BUFFERS_NBR 						CAN_RX_STD_FILT_NBR
-#define CAN_RX_FIFO0_ELMTS_SIZE 				(0U)
+#define	CAN_RX_BUFFERS_NBR 						(0U)
+#define CAN_RX_FIFO0_ELMTS_SIZE 				(18U) //words: 2 header + 16 data (64 bytes)
 #define CAN_RX_FIFO1_ELMTS_SIZE 				(0U)
-#define CAN_RX_BUFFERS_SIZE 					(4U)
-#define	CAN_TX_EVENTS_NBR 						(2U)
-#define	CAN_TX_BUFFERS_NBR 						(32U) //change number of buffers if new added
-#define CAN_TX_FIFO_QUEUE_ELMTS_NBR 			(0U)
-#define CAN_TX_ELMTS_SIZE 						(4U)
+#define CAN_RX_BUFFERS_SIZE 					(18U) //words: 2 header + 16 data (64 bytes)
+#define	CAN_TX_EVENTS_NBR 						(16U) //one event per Tx FIFO element
+#define	CAN_TX_BUFFERS_NBR 						(0U)  //no dedicated Tx buffers, all msgs go via Tx FIFO (NDTB + TFQS <= 32)
+#define CAN_TX_FIFO_QUEUE_ELMTS_NBR 			(16U) //all msgs are sent via Tx FIFO, so they go to the bus in the order they were sent (maximum value 32)
+#define CAN_TX_ELMTS_SIZE 						(18U) //words: 2 header + 16 data (64 bytes)
+#define CAN_ELMTS_DATA_FIELD 					(7U)  //code of 64 byte data field for TXESC/RXESC
+#define CAN_MSG_RAM_END_ADDRESS 				(SRAMCAN_BASE + 0x2800U - 4U) //last address of the Message RAM (10 Kbytes)
+
+#define CAN_RX_RING_SIZE 						(64U) //Rx msgs ring between FDCAN1 interrupt and main loop, power of 2
+#define CAN1_IRQ_PRIORITY 						(1U)
 
 
 
@@ -94,11 +112,21 @@ For Clock 32MHz
 #define FDCAN_DLC_BYTES_6  						((uint32_t)0x00060000U) /*!< 6 bytes data field  */
 #define FDCAN_DLC_BYTES_7  						((uint32_t)0x00070000U) /*!< 7 bytes data field  */
 #define FDCAN_DLC_BYTES_8  						((uint32_t)0x00080000U) /*!< 8 bytes data field  */
+#define FDCAN_DLC_BYTES_12 						((uint32_t)0x00090000U) /*!< 12 bytes data field */
+#define FDCAN_DLC_BYTES_16 						((uint32_t)0x000A0000U) /*!< 16 bytes data field */
+#define FDCAN_DLC_BYTES_20 						((uint32_t)0x000B0000U) /*!< 20 bytes data field */
+#define FDCAN_DLC_BYTES_24 						((uint32_t)0x000C0000U) /*!< 24 bytes data field */
+#define FDCAN_DLC_BYTES_32 						((uint32_t)0x000D0000U) /*!< 32 bytes data field */
+#define FDCAN_DLC_BYTES_48 						((uint32_t)0x000E0000U) /*!< 48 bytes data field */
+#define FDCAN_DLC_BYTES_64 						((uint32_t)0x000F0000U) /*!< 64 bytes data field */
 
 #define FDCAN_ESI_ACTIVE  						((uint32_t)0x00000000U) /*!< Transmitting node is error active  */
 #define FDCAN_BRS_OFF 							((uint32_t)0x00000000U) /*!< FDCAN frames transmitted/received without bit rate switching */
+#define FDCAN_BRS_ON 							((uint32_t)0x00100000U) /*!< FDCAN frames transmitted/received with bit rate switching */
 #define FDCAN_CLASSIC_CAN 						((uint32_t)0x00000000U) /*!< Frame transmitted/received in Classic CAN format */
+#define FDCAN_FD_CAN 							((uint32_t)0x00200000U) /*!< Frame transmitted/received in FDCAN format */
 #define FDCAN_NO_TX_EVENTS    					((uint32_t)0x00000000U) /*!< Do not store Tx events */
+#define FDCAN_STORE_TX_EVENTS 					((uint32_t)0x00800000U) /*!< Store Tx events */
 
 /* FDCAN_Tx_location  */
 #define FDCAN_TX_BUFFER0  						((uint32_t)0x00000001U) /*!< Add message to Tx Buffer 0  */
@@ -201,6 +229,8 @@ For Clock 32MHz
 #define FDCAN_RX_BUFFER63 						((uint32_t)0x0000003FU) /*!< Get received message from Rx Buffer 63 */
 
 #define FDCAN_STANDARD_ID 				 		((uint32_t)0x00000000U) /*!< Standard ID element */
+#define FDCAN_FILTER_TO_RXFIFO0    				((uint32_t)0x00000001U) /*!< Store in Rx FIFO 0 if filter matches */
+#define FDCAN_FILTER_TO_RXFIFO1    				((uint32_t)0x00000002U) /*!< Store in Rx FIFO 1 if filter matches */
 #define FDCAN_FILTER_TO_RXBUFFER   				((uint32_t)0x00000007U) /*!< Store into Rx Buffer, configuration of FilterType ignored */
 #define FDCAN_FILTER_DUAL          				((uint32_t)0x00000001U) /*!< Dual ID filter for FilterID1 or FilterID2 */
 
@@ -365,9 +395,34 @@ typedef struct
 /* CAN Msg structures ----------------- */
 
 
+typedef struct typeDefCanRxFrame
+{
+	FDCAN_RxHeaderTypeDef header;
+	uint8_t length;					// data length, bytes
+	uint8_t data[64];
+}typeDefCanRxFrame;
+
+
+typedef struct typeDefCanRxStat
+{
+	uint32_t fifoLost;				// Rx FIFO 0 was full and FDCAN dropped a msg (blocking mode)
+	uint32_t ringFull;				// FIFO 0 was not emptied because the ring was full
+	uint32_t fifoMaxLevel;			// maximum fill level of Rx FIFO 0 seen
+}typeDefCanRxStat;
+
+
+typedef struct typeDefCanTxStat
+{
+	uint32_t queued;				// msgs put to Tx FIFO
+	uint32_t confirmed;				// msgs sent to the bus (Tx event FIFO)
+	uint32_t fifoFull;				// msg was not queued because Tx FIFO was full, it is sent later
+}typeDefCanTxStat;
+
+
 typedef struct typeDefCanMessage
 {
-	uint8_t data[8];
+	uint8_t data[64];
+	uint8_t length;					// received data length, bytes
 	uint16_t onetime_transmit;
 	uint16_t always_transmit;
 }typeDefCanMessage;
@@ -377,16 +432,35 @@ typedef struct typeDefCanMessage
 
 
 
+/* Variables -----------------------------------------------------------------*/
+
+extern uint8_t DLCtoBytes[16];		// in RAM: read by Rx/Tx while BANK1 is busy
+
+
 /* Functions -----------------------------------------------------------------*/
 
 uint16_t InitCAN1 (uint32_t *idArray);
+void DeInitCAN1 (void);
 
 void RxFilterRegisterConfig (FDCAN_FilterTypeDef *pRxFilter);
 void Config_RxFilters (uint32_t *idArray);
 void Config_TxFilters (void);
 
-void ReceiveCanMsg (uint32_t RxLocation, uint8_t *pRxData, uint16_t CanModule);
-void FDCAN_SendMessage(FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData, uint32_t BufferIndex, uint16_t CanModule);
+void Config_TxFrameFormat (uint32_t FDFormat, uint32_t BitRateSwitch);
+
+uint8_t ReceiveCanMsg (uint32_t RxLocation, FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData, uint16_t CanModule);
+uint8_t ReadRxElement (uint32_t *RxAddress, FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData);
+uint16_t CAN1_RxRingPop (typeDefCanRxFrame *pFrame);
+void CAN1_RxFifoDrain (void);
+void CAN1_RxPoll (void);
+typeDefCanRxStat CAN1_GetRxStat (void);
+void FDCAN1_IT0_IRQHandler (void);
+uint16_t FDCAN_SendFifo(FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData, uint16_t CanModule);
+uint8_t FDCAN_TxFifoFree(uint16_t CanModule);
+void WriteTxElement (uint32_t *TxAddress, FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData);
+void CAN1_TxEventPoll (void);
+uint32_t CAN1_TxPending (void);
+typeDefCanTxStat CAN1_GetTxStat (void);
 
 
 #endif /* CAN_H_IFND */
@@ -0,0 +1,24 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef CRC_H_IFND
+#define CRC_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define CRC32_INIT				(0xFFFFFFFFU)
+#define CRC32_XOR_OUT			(0xFFFFFFFFU)
+
+
+/* Functions -----------------------------------------------------------------*/
+
+void CrcInit(void);
+uint32_t CrcCalc32(uint32_t address, uint32_t size);
+
+#endif /* CRC_H_IFND */
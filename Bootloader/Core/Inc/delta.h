@@ -0,0 +1,26 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef DELTA_H_IFND
+#define DELTA_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define DELTA_CTRL_SIZE						(12U)	// diff length, extra length, old seek
+
+enum DELTA_STATE{DELTA_ST_CTRL, DELTA_ST_DIFF, DELTA_ST_EXTRA};
+
+
+/* Functions -----------------------------------------------------------------*/
+
+void DeltaStart(void);
+uint8_t DeltaFailed(void);
+uint16_t DeltaDecode(const uint8_t *pIn, uint16_t inSize, uint8_t *pOut, uint16_t outSize, uint16_t *pOutLen);
+
+#endif /* DELTA_H_IFND */
@@ -12,9 +12,13 @@
 
 /* Defines -------------------------------------------------------------------*/
 
-enum FLASH_STATUS{FLASH_RDY, FLASH_WRP_ERROR, FLASH_PGM_ERROR, FLASH_LATENCY_ERROR, FLASH_LOCK_ERROR};
+enum FLASH_STATUS{FLASH_RDY, FLASH_WRP_ERROR, FLASH_PGM_ERROR, FLASH_LATENCY_ERROR, FLASH_LOCK_ERROR, FLASH_BUSY};
 
-enum FLASH_SECTOR{Sector0, Sector1, Sector2, Sector3, Sector4, Sector5, Sector6, Sector7};
+/* events of the non-blocking flash engine (flashProcess) */
+enum FLASH_EVENT{FLASH_EV_NONE, FLASH_EV_DONE, FLASH_EV_ERROR};
+
+enum FLASH_SECTOR{Sector0, Sector1, Sector2, Sector3, Sector4, Sector5, Sector6, Sector7,
+				  Sector8, Sector9, Sector10, Sector11, Sector12, Sector13, Sector14, Sector15};
 
 #define FLASH_SECTOR_BOOTLOADER		Sector0
 #define FLASH_SECTOR_CONFIG_DATA	Sector1
@@ -32,6 +36,25 @@ enum FLASH_SECTOR{Sector0, Sector1, Sector2, Sector3, Sector4, Sector5, Sector6,
 #define ADDR_FLASH_SECTOR_6_BANK1     	((uint32_t)0x080C0000) /* Sector 6, 128 Kbytes */
 #define ADDR_FLASH_SECTOR_7_BANK1     	((uint32_t)0x080E0000) /* Sector 7, 128 Kbytes */
 
+/* Base address of the Flash sectors Bank 2, they are Sector8..Sector15 */
+#define ADDR_FLASH_SECTOR_0_BANK2    	((uint32_t)0x08100000) /* Sector 8, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_1_BANK2     	((uint32_t)0x08120000) /* Sector 9, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_2_BANK2     	((uint32_t)0x08140000) /* Sector 10, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_3_BANK2     	((uint32_t)0x08160000) /* Sector 11, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_4_BANK2     	((uint32_t)0x08180000) /* Sector 12, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_5_BANK2     	((uint32_t)0x081A0000) /* Sector 13, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_6_BANK2     	((uint32_t)0x081C0000) /* Sector 14, 128 Kbytes */
+#define ADDR_FLASH_SECTOR_7_BANK2     	((uint32_t)0x081E0000) /* Sector 15, 128 Kbytes */
+
+/* geometry: sector n is in bank n / FLASH_SECTORS_BANK (flash.c 'flashBank'). BANK2 is also the
+ * inactive slot of A/B update: banks are swapped by option byte SWAP_BANK */
+#define FLASH_BANKS						(2U)
+#define FLASH_SECTORS_BANK				(8U)
+#define FLASH_SECTORS_NBR				(FLASH_BANKS * FLASH_SECTORS_BANK)
+
+#define FLASH_OPT_KEY1					(0x08192A3BU)
+#define FLASH_OPT_KEY2					(0x4C5D6E7FU)
+
 
 #define FLASH_FLAG_BSY_BANK1            FLASH_SR_BSY           /*!< FLASH Bank 1 Busy flag */
 #define FLASH_FLAG_WBNE_BANK1           FLASH_SR_WBNE          /*!< Write Buffer Not Empty on Bank 1 flag */
@@ -63,11 +86,42 @@ enum FLASH_SECTOR{Sector0, Sector1, Sector2, Sector3, Sector4, Sector5, Sector6,
 
 #define EIGHT_BITS						(8U)                    // bits in byte
 
+/* Benchmark of flash word programming: command 0xE1 erases FLASH_BENCH_SECTOR and compares cycles
+ * of the previous byte by byte flashWrite and the current one (DWT cycle counter).
+ * DESTRUCTIVE: every sector after the config data belongs to the application, which starts at
+ * APP_PROG_ADDRESS, so the benchmark destroys the application there. 0xE1 is refused
+ * (0 cycles are answered) when an application is installed or a download is in progress */
+//#define FLASH_BENCHMARK
+#define FLASH_BENCH_SECTOR				Sector7
+#define FLASH_BENCH_SIZE				(1024U)                 // bytes written by each version
+
+
+
+/* TypeDefines ---------------------------------------------------------------*/
+
+/* one bank of the geometry table: its address range and its registers */
+typedef struct
+{
+	uint32_t base;						// address of the first sector
+	uint8_t firstSector;				// number of the first sector, all sectors are FLASH_SECTOR_SIZE
+	__IO uint32_t *KEYR;
+	__IO uint32_t *CR;
+	__IO uint32_t *SR;
+	__IO uint32_t *CCR;
+}typeDefFlashBank;
+
+typedef struct
+{
+	uint32_t cyclesBytes;				// previous flashWrite: byte stores, wait after every flash word
+	uint32_t cyclesWide;				// flashWrite: 64-bit stores, next word loaded while previous is programmed
+}typeDefFlashBench;
+
+
 
 
 /* Functions -----------------------------------------------------------------*/
 
-enum FLASH_STATUS flash_WaitForLastOperation(void); //__attribute__ ((section(".fast")));
+enum FLASH_STATUS flash_WaitForLastOperation(const typeDefFlashBank *pBank);
 
 
 enum FLASH_STATUS flashUnlock(void);
@@ -76,8 +130,36 @@ enum FLASH_STATUS flashLock(void);
 uint32_t flashRead(uint32_t address);
 
 enum FLASH_STATUS flashWrite( uint32_t FlashAddress, uint32_t DataAddress, int DataSize);
+uint32_t flash_LoadFlashWord(__IO uint8_t *dest_addr, uint8_t *src_addr, uint32_t DataSize);
+enum FLASH_STATUS flash_WaitForWriteBuffer(const typeDefFlashBank *pBank);
+uint8_t flash_IsErasedPattern(uint8_t *src_addr, uint32_t DataSize);
 enum FLASH_STATUS flash_EraseSector(uint32_t sectorNumb);
 enum FLASH_STATUS flash_EraseAll(void);
 
+/* non-blocking API: operation is submitted and then advanced by flashProcess from main loop,
+ * one operation per bank, 'bank' - index in the geometry table (sector / FLASH_SECTORS_BANK) */
+enum FLASH_STATUS flashSubmitErase(uint32_t sectorNumb);
+enum FLASH_STATUS flashSubmitWrite(uint32_t FlashAddress, uint32_t DataAddress, int DataSize);
+enum FLASH_EVENT flashProcess(uint32_t bank);
+uint8_t flashBusy(void);
+uint8_t flashBankBusy(uint32_t bank);
+enum FLASH_STATUS flashGetError(uint32_t bank);
+enum FLASH_STATUS flash_GetStatus(uint32_t status);
+
+const typeDefFlashBank *flash_GetBank(uint32_t address);
+uint32_t flash_GetSector(uint32_t address);
+uint32_t flash_SectorAddress(uint32_t sectorNumb);
+enum FLASH_STATUS flashBankUnlock(const typeDefFlashBank *pBank);
+enum FLASH_STATUS flashBankLock(const typeDefFlashBank *pBank);
+
+/* A/B slots: bank at ADDR_FLASH_SECTOR_0_BANK2 becomes the running one after reset */
+enum FLASH_STATUS flashSwapBanks(void);
+uint8_t flashBanksSwapped(void);
+
+#ifdef FLASH_BENCHMARK
+enum FLASH_STATUS flashWriteBytes( uint32_t FlashAddress, uint32_t DataAddress, int DataSize);
+typeDefFlashBench flashBenchmark(uint32_t sectorNumb);
+#endif
+
 #endif /* TIMERS_H_IFND */
 
@@ -0,0 +1,44 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef GROUP_H_IFND
+#define GROUP_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+#include "prog.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define CAN_GROUP_CMD_ID					(0x5A0U)	// commands to all boards of a group download
+#define CAN_GROUP_DATA_ID					(0x5B0U)	// program text to all boards of a group download
+#define CAN_GROUP_STATUS_ID					(0x5C0U)	// + board id: answers 0x550 of a group download
+#define PROG_BLOCKS_MAX						(APP_PROG_MAX_SIZE / PROG_BLOCK_SIZE)
+
+#define PROG_MSG_LENGTH						(8U)	// classic CAN
+#define PROG_MSG_LENGTH_FD					(64U)	// CAN-FD
+#define PROG_SEQ_FRAMES_MAX					(256U)	// msgs 0x57x with sequence number in one block
+
+
+/* Functions -----------------------------------------------------------------*/
+
+uint8_t GroupFrameAccepted(uint32_t id, uint8_t command);
+uint8_t GroupSelect(uint8_t groupCmd, const uint8_t *pCmd, uint32_t length, uint8_t boardId);
+void GroupStop(void);
+void GroupStart(uint32_t imageSize);
+uint8_t GroupActive(void);
+uint16_t GroupBlocks(void);
+uint8_t GroupBlockReceived(uint16_t blockIdx);
+uint16_t GroupMarkBlocks(uint16_t blockIdx, uint16_t count, uint16_t nextBlockIdx);
+
+uint8_t GroupSeqStart(const uint8_t *pCmd, uint32_t length);
+uint8_t GroupSeqMode(void);
+void GroupSeqReceive(uint8_t *pBuff, const uint8_t *pMsg, uint8_t length, uint32_t *pLength);
+void GroupSeqRecover(uint8_t *pBuff, uint32_t *pLength);
+uint8_t GroupSeqMissing(void);
+void GroupSeqNack(uint8_t *pBase, uint32_t *pMap);
+
+#endif /* GROUP_H_IFND */
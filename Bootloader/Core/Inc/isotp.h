@@ -0,0 +1,60 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef ISOTP_H_IFND
+#define ISOTP_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+#include "can.h"
+#include "prog.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define ISOTP_RX_ID							(0x5D0U)	// + board id: frames from host
+#define ISOTP_TX_ID							(0x5E0U)	// + board id: frames to host
+
+#define ISOTP_FRAME_MAX						(64U)		// CAN-FD
+#define ISOTP_DATA_MAX						(4U * PROG_BLOCK_SIZE)	// program bytes of the longest msg (TransferData, 0xBE)
+#define ISOTP_MSG_MAX						(ISOTP_DATA_MAX + 16U)	// the longest msg: block with its header
+#define ISOTP_BLOCK_SIZE					(CAN_RX_RING_SIZE)		// BS: consecutive frames which the Rx ring takes without waiting
+#define ISOTP_ST_MIN						(0U)		// STmin: frames are moved to the ring by interrupt at full bus load
+#define ISOTP_PADDING						(0xCCU)
+
+#define ISOTP_TIMEOUT_CR					(1000U)		// ms, N_Cr: consecutive frame is not received
+#define ISOTP_WAIT_PERIOD					(500U)		// ms, FC WAIT is repeated while msg buffer is busy (host N_Bs is 1000 ms)
+#define ISOTP_WAIT_MAX						(20U)		// N_WFTmax, then FC OVFLW
+
+/* protocol control information */
+#define ISOTP_PCI_SF						(0x00U)
+#define ISOTP_PCI_FF						(0x10U)
+#define ISOTP_PCI_CF						(0x20U)
+#define ISOTP_PCI_FC						(0x30U)
+
+#define ISOTP_FC_CTS						(0x00U)
+#define ISOTP_FC_WAIT						(0x01U)
+#define ISOTP_FC_OVFLW						(0x02U)
+
+enum ISOTP_STATE{ISOTP_ST_IDLE, ISOTP_ST_RX, ISOTP_ST_READY};
+
+
+/* Functions -----------------------------------------------------------------*/
+
+void IsoTpInit(uint32_t txId);
+void IsoTpReceiveFrame(typeDefCanRxFrame *pFrame);
+void IsoTpProcess(void);
+void IsoTpTick1ms(void);
+
+uint8_t *IsoTpGetMsg(uint32_t *pSize);
+void IsoTpReleaseMsg(void);
+uint8_t IsoTpSend(uint8_t *pData, uint8_t size);
+uint8_t IsoTpTxBusy(void);
+
+void IsoTpStartRx(uint32_t size, uint8_t *pData, uint8_t length);
+void IsoTpSendFlowControl(uint8_t flowStatus);
+uint16_t IsoTpSendFrame(uint8_t *pData, uint8_t length);
+
+#endif /* ISOTP_H_IFND */
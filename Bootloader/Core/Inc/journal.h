@@ -0,0 +1,45 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef JOURNAL_H_IFND
+#define JOURNAL_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+#include "flash.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define JOURNAL_ADDRESS						(D3_BKPSRAM_BASE)	// backup SRAM, 4 KB
+#define JOURNAL_RECORDS						(16U)				// records in the ring
+#define JOURNAL_MAGIC						(0x4C4E524AU)		// "JRNL"
+
+
+/* TypeDefines ---------------------------------------------------------------*/
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t seq;						// the newest valid record is the journal state
+	uint32_t imageId;					// set by host (CRC32 of the image), 0 - unknown
+	uint32_t imageSize;
+	uint32_t committed;					// bytes from APP_PROG_ADDRESS which are in flash
+	uint32_t reserved[2];
+	uint8_t head[NB_8BIT_IN_FLASHWORD];	// the first flash word of the image, it is programmed the last
+	uint32_t crc;						// CRC32 of the fields above
+}journalRecordTypeDef;
+
+
+/* Functions -----------------------------------------------------------------*/
+
+void JournalInit(void);
+void JournalStart(uint32_t imageSize);
+void JournalSetId(uint32_t imageId);
+void JournalCommit(uint32_t committed, uint8_t *pHead);
+journalRecordTypeDef *JournalGet(void);
+void JournalAppend(journalRecordTypeDef *pRecord);
+
+#endif /* JOURNAL_H_IFND */
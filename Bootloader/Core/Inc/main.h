@@ -10,6 +10,13 @@
 #include "can.h"
 #include "rcc.h"
 #include "flash.h"
+#include "prog.h"
+#include "unpack.h"
+#include "crc.h"
+#include "journal.h"
+#include "isotp.h"
+#include "uds.h"
+#include "group.h"
 #include "timer.h"
 
 /* Defines -------------------------------------------------------------------*/
@@ -31,7 +38,25 @@
  void Actions_CAN_0x56x_received(void);
  void Actions_CAN_0x57x_received(void);
 
+ enum PROG_STATUS StartDownload(void);
+ enum PROG_STATUS ResumeDownload(void);
+ uint8_t SlotReady(void);
+ void CheckStagedBlocks(void);
+ void SendWindowAck(uint8_t status);
+ uint8_t SkipBlocks(uint16_t blockIdx, uint16_t count, uint8_t fill);
+ uint8_t BlockAcceptable(uint16_t blockIdx);
+ uint8_t BlockChecksum(void);
+ void SendRxStat(void);
+ void SendDownloadStat(void);
+ void SendJournal(void);
+ void CheckHashQuery(void);
+ void CheckSlotSwap(void);
+#ifdef FLASH_BENCHMARK
+ void SendFlashBench(void);
+#endif
+
  void CheckRxMessageCAN1 (void);
+ void CheckIsoTpMessage(void);
  void CheckTxMessageCAN1 (void);
 
  void InitLEDs(void);
@@ -0,0 +1,83 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef PROG_H_IFND
+#define PROG_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+#include "flash.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define APP_PROG_ADDRESS 					(0x8040000U)
+#define APP_PROG_MAX_SIZE					(ADDR_FLASH_SECTOR_7_BANK2 + FLASH_SECTOR_SIZE - APP_PROG_ADDRESS)	// up to the end of BANK2
+#define APP_SLOT_MAX_SIZE					(ADDR_FLASH_SECTOR_7_BANK1 + FLASH_SECTOR_SIZE - APP_PROG_ADDRESS)	// A/B slot: up to the end of the bank
+
+#define PROG_BLOCK_SIZE						(1024U)	// bytes between commands 0xBB and 0xCC, default block size
+#define PROG_BLOCK_SIZE_MAX					(FLASH_SECTOR_SIZE)	// block size negotiated at 0xAB: PROG_BLOCK_SIZE << n, up to one sector
+#define PROG_STAGE_BUFFERS					(4U)	// blocks which can wait for flash programming (incl. the one received now)
+#define PROG_STAGE_POOL_SIZE				(2U * PROG_BLOCK_SIZE_MAX)	// staging buffers of the negotiated size are cut from it
+
+#define PROG_SECTOR_NONE					(0xFFU)	// patch mode: no sector in 'patchBuff'
+
+enum PROG_STATUS{PROG_IDLE, PROG_BUSY, PROG_BLOCK_WRITTEN, PROG_ERROR};
+
+enum PROG_STATE{PROG_ST_IDLE, PROG_ST_ERASE, PROG_ST_WRITE, PROG_ST_BACKUP_ERASE, PROG_ST_BACKUP_WRITE, PROG_ST_HEAD_WRITE,
+				PROG_ST_SLOT_ERASE, PROG_ST_SLOT_WRITE};
+
+enum PROG_STAGE_STATE{PROG_STAGE_QUEUED, PROG_STAGE_WRITE, PROG_STAGE_WRITTEN};
+
+
+/* TypeDefines ---------------------------------------------------------------*/
+
+typedef struct
+{
+	uint8_t *data;						// in 'stagePool', aligned for 64-bit stores to flash
+	uint32_t offset;					// offset of the block from the image address (APP_PROG_ADDRESS or its slot)
+	enum PROG_STAGE_STATE state;		// blocks of both banks are written at the same time, see ProgLanesNext
+}progStageTypeDef;
+
+
+/* Functions -----------------------------------------------------------------*/
+
+enum PROG_STATUS ProgStart(uint32_t imageSize);
+void ProgAbort(void);
+void ProgSetPatchMode(void);
+void ProgSetSparseMode(void);
+enum PROG_STATUS ProgSetDeltaMode(void);
+enum PROG_STATUS ProgSetSlotMode(void);
+uint8_t ProgSlotReady(void);
+uint32_t ProgResume(uint32_t imageSize, uint32_t offset, uint8_t *pHead);
+uint32_t ProgCommitted(void);
+uint8_t *ProgGetHead(void);
+uint8_t ProgReadOld(uint32_t offset, uint8_t *pData);
+void ProgFinish(void);
+void ProgSkip(uint32_t offset, uint32_t size);
+uint32_t ProgSetBlockSize(uint32_t size);
+uint32_t ProgBlockSize(void);
+
+uint8_t *ProgGetRxBuffer(void);
+void ProgQueueRxBuffer(uint32_t offset);
+uint8_t ProgFreeBuffers(void);
+uint8_t ProgPending(void);
+uint8_t ProgFailed(void);
+
+enum PROG_STATUS ProgProcess(void);
+uint8_t ProgEraseDue(void);
+uint8_t ProgHeadDue(void);
+uint8_t ProgSlotCopyDue(void);
+enum FLASH_STATUS ProgSlotCopyNext(void);
+enum FLASH_STATUS ProgLaneDone(uint32_t bank, uint8_t *pBlockWritten);
+void ProgReleaseBlocks(uint8_t *pBlockWritten);
+enum FLASH_STATUS ProgLanesNext(void);
+enum FLASH_STATUS ProgSubmitErase(enum PROG_STATE state, uint32_t sectorNumb);
+enum FLASH_STATUS ProgSubmitWrite(enum PROG_STATE state, uint32_t FlashAddress, uint32_t DataAddress, int DataSize);
+enum FLASH_STATUS ProgSubmitBlock(uint32_t stageIdx);
+enum FLASH_STATUS ProgPatchNext(uint8_t *pBlockTaken);
+enum FLASH_STATUS ProgPatchFlush(void);
+
+#endif /* PROG_H_IFND */
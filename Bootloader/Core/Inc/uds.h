@@ -0,0 +1,69 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef UDS_H_IFND
+#define UDS_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+#include "prog.h"
+#include "isotp.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+/* services */
+#define UDS_SID_SESSION_CONTROL				(0x10U)
+#define UDS_SID_ECU_RESET					(0x11U)
+#define UDS_SID_ROUTINE_CONTROL				(0x31U)
+#define UDS_SID_REQUEST_DOWNLOAD			(0x34U)
+#define UDS_SID_TRANSFER_DATA				(0x36U)
+#define UDS_SID_TRANSFER_EXIT				(0x37U)
+#define UDS_SID_TESTER_PRESENT				(0x3EU)
+#define UDS_SID_NEGATIVE_RESPONSE			(0x7FU)
+#define UDS_POSITIVE_RESPONSE				(0x40U)		// + SID
+#define UDS_SUPPRESS_RESPONSE				(0x80U)		// bit of sub-function
+
+/* negative response codes */
+#define UDS_NRC_SERVICE_NOT_SUPPORTED		(0x11U)
+#define UDS_NRC_SUBFUNCTION_NOT_SUPPORTED	(0x12U)
+#define UDS_NRC_INCORRECT_LENGTH			(0x13U)
+#define UDS_NRC_CONDITIONS_NOT_CORRECT		(0x22U)
+#define UDS_NRC_REQUEST_SEQUENCE_ERROR		(0x24U)
+#define UDS_NRC_REQUEST_OUT_OF_RANGE		(0x31U)
+#define UDS_NRC_DOWNLOAD_NOT_ACCEPTED		(0x70U)
+#define UDS_NRC_PROGRAMMING_FAILURE			(0x72U)
+#define UDS_NRC_WRONG_BLOCK_COUNTER			(0x73U)
+#define UDS_NRC_RESPONSE_PENDING			(0x78U)
+
+/* routines (0x31 sub-function 0x01 - start) */
+#define UDS_ROUTINE_START					(0x01U)
+#define UDS_ROUTINE_ERASE_MEMORY			(0xFF00U)	// addressAndLengthFormatIdentifier, address, size
+#define UDS_ROUTINE_CHECK_MEMORY			(0x0202U)	// CRC32 of the image (zlib)
+
+#define UDS_BLOCK_SIZE						(ISOTP_DATA_MAX)	// program bytes of TransferData: one staging buffer which fits ISO-TP msg
+#define UDS_P2_SERVER_MAX					(50U)		// ms
+#define UDS_P2X_SERVER_MAX					(5000U)		// ms, after response pending
+
+enum UDS_STATE{UDS_ST_IDLE, UDS_ST_ERASE, UDS_ST_DOWNLOAD, UDS_ST_EXIT};
+
+
+/* Functions -----------------------------------------------------------------*/
+
+uint8_t UdsIsService(uint8_t sid);
+uint8_t UdsRequest(uint8_t *pMsg, uint32_t size);
+void UdsProcess(void);
+uint8_t UdsActive(void);
+void UdsStop(void);
+
+void UdsRoutineControl(uint8_t *pMsg, uint32_t size);
+void UdsRequestDownload(uint8_t *pMsg, uint32_t size);
+uint8_t UdsTransferData(uint8_t *pMsg, uint32_t size);
+void UdsTransferExit(uint8_t *pMsg, uint32_t size);
+uint8_t UdsParseAddress(uint8_t *pParam, uint32_t size, uint32_t *pAddress, uint32_t *pLength);
+void UdsRespond(uint8_t *pData, uint8_t size);
+void UdsNegative(uint8_t sid, uint8_t nrc);
+
+#endif /* UDS_H_IFND */
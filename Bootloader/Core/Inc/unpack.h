@@ -0,0 +1,52 @@
+/*----------------------------------------------------------------------------*/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef UNPACK_H_IFND
+#define UNPACK_H_IFND
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32h7xx.h"
+#include "prog.h"
+
+
+/* Defines -------------------------------------------------------------------*/
+
+/* heatshrink parameters, image should be compressed with the same ones:
+ * heatshrink -e -w 10 -l 4 app.bin app.hs */
+#define UNPACK_WINDOW_BITS					(10U)	// window 1024 bytes
+#define UNPACK_LOOKAHEAD_BITS				(4U)	// back-reference up to 16 bytes
+#define UNPACK_WINDOW_SIZE					(1U << UNPACK_WINDOW_BITS)
+
+#define UNPACK_RX_BUFFERS					(2U)	// compressed blocks which can wait for decompression
+
+enum UNPACK_FORMAT{UNPACK_HEATSHRINK, UNPACK_DELTA};
+
+enum UNPACK_STATE{UNPACK_ST_TAG, UNPACK_ST_LITERAL, UNPACK_ST_INDEX, UNPACK_ST_COUNT, UNPACK_ST_BACKREF};
+
+
+/* TypeDefines ---------------------------------------------------------------*/
+
+typedef struct
+{
+	uint8_t data[PROG_BLOCK_SIZE] __ALIGNED(4);	// aligned for CRC32 of block (0xCC)
+	uint16_t size;						// compressed bytes in block
+}unpackRxTypeDef;
+
+
+/* Functions -----------------------------------------------------------------*/
+
+void UnpackStart(enum UNPACK_FORMAT format);
+void UnpackFinish(void);
+
+uint8_t *UnpackGetRxBuffer(void);
+void UnpackQueueRxBuffer(uint16_t size);
+uint8_t UnpackFreeBuffers(void);
+uint8_t UnpackDone(void);
+uint32_t UnpackOutSize(void);
+
+enum PROG_STATUS UnpackProcess(void);
+uint16_t UnpackDecode(const uint8_t *pIn, uint16_t inSize, uint8_t *pOut, uint16_t outSize, uint16_t *pOutLen);
+
+#endif /* UNPACK_H_IFND */
@@ -9,10 +9,23 @@
 #include "can.h"
 
 /* Variables -----------------------------------------------------------------*/
+/*--- Not const: constants stay in flash, this one is read while BANK1 is busy ---*/
+uint8_t DLCtoBytes[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
 static uint32_t StdFilterSA = 0;
+static uint32_t RxFIFO0SA = 0;
 static uint32_t RxBufferSA = 0;
 static uint32_t TxBufferSA = 0;
 
+/*--- Rx ring (single producer - FDCAN1 interrupt, single consumer - main loop) ---*/
+static typeDefCanRxFrame rxRing[CAN_RX_RING_SIZE];
+static volatile uint32_t rxRingHead = 0;
+static volatile uint32_t rxRingTail = 0;
+static volatile typeDefCanRxStat rxStat;
+
+/*--- Tx FIFO statistics: msgs are sent by main loop only, confirmed by Tx event FIFO ---*/
+static typeDefCanTxStat txStat;
+
 /*--- TxHeader Filters Variables ---*/
 FDCAN_TxHeaderTypeDef headerTxMsg_0x550;
 FDCAN_TxHeaderTypeDef headerTxMsg_0x551;
@@ -22,6 +35,7 @@ FDCAN_TxHeaderTypeDef headerTxMsg_0x555;
 /*--- RxHeader Filters Variables ---*/
 FDCAN_FilterTypeDef headerRxMsg_0x56x;
 FDCAN_FilterTypeDef headerRxMsg_0x57x;
+FDCAN_FilterTypeDef headerRxMsg_IsoTp;
 
 
 /* Functions -----------------------------------------------------------------*/
@@ -31,7 +45,6 @@ uint16_t InitCAN1 (uint32_t *idArray)
 {		
 
 	uint32_t ExtStdFilterSA = 0;
-	uint32_t RxFIFO0SA = 0;
 	uint32_t RxFIFO1SA = 0;
 	uint32_t TxEventFIFOSA = 0;
 	uint32_t TxFIFOQSA = 0;
@@ -90,18 +103,29 @@ uint16_t InitCAN1 (uint32_t *idArray)
 	FDCAN1->CCCR &= (FDCAN_CCCR_INIT | FDCAN_CCCR_CCE); 						// clear all bits (except INIT and CCE)
 	//FDCAN1->CCCR |= FDCAN_CCCR_DAR;											//no automatic retransmission
 	FDCAN1->CCCR |= FDCAN_CCCR_PXHD; 											//Set the Protocol Exception Handling
+	FDCAN1->CCCR |= FDCAN_CCCR_FDOE | FDCAN_CCCR_BRSE;							//CAN-FD frames and bit rate switching (classic frames are still accepted)
 				
 	/* Set the nominal bit timing register */
 	FDCAN1->NBTP = ((((uint32_t)CAN1_NSJW - 1) << 25)  | \
                     (((uint32_t)CAN1_NTSEG1 - 1) << 8) | \
                      ((uint32_t)CAN1_NTSEG2 - 1)       | \
                     (((uint32_t)CAN1_NBRP - 1) << 16));
+
+	/* Set the data bit timing register (used for CAN-FD frames with bit rate switching) */
+	FDCAN1->DBTP = ((((uint32_t)CAN1_DSJW - 1) << FDCAN_DBTP_DSJW_Pos)    | \
+                    (((uint32_t)CAN1_DTSEG1 - 1) << FDCAN_DBTP_DTSEG1_Pos) | \
+                    (((uint32_t)CAN1_DTSEG2 - 1) << FDCAN_DBTP_DTSEG2_Pos) | \
+                    (((uint32_t)CAN1_DBRP - 1) << FDCAN_DBTP_DBRP_Pos)     | \
+                     FDCAN_DBTP_TDC);
+	FDCAN1->TDCR = (CAN1_TDCO << FDCAN_TDCR_TDCO_Pos);
 		
 	/* Configure Tx element size */
-	FDCAN1->TXESC &= ~FDCAN_TXESC_TBDS;  /* 8 byte data field */
+	FDCAN1->TXESC = (CAN_ELMTS_DATA_FIELD << FDCAN_TXESC_TBDS_Pos);  /* 64 byte data field */
 
 	/* Configure Rx element size */
-	FDCAN1->RXESC &= ~FDCAN_RXESC_RBDS;
+	FDCAN1->RXESC = (CAN_ELMTS_DATA_FIELD << FDCAN_RXESC_RBDS_Pos) | \
+	                (CAN_ELMTS_DATA_FIELD << FDCAN_RXESC_F0DS_Pos) | \
+	                (CAN_ELMTS_DATA_FIELD << FDCAN_RXESC_F1DS_Pos);
 		
 	/* Standard filter list start address */
 	StdFilterSA = 0;
@@ -122,6 +146,8 @@ uint16_t InitCAN1 (uint32_t *idArray)
 	FDCAN1->RXF0C |= (RxFIFO0SA << FDCAN_RXF0C_F0SA_Pos);
 	/* Rx FIFO 0 elements number */
 	FDCAN1->RXF0C |= (CAN_RX_FIFO0_ELMTS_NBR << FDCAN_RXF0C_F0S_Pos);
+	/* Rx FIFO 0 watermark, blocking mode (F0OM = 0): when FIFO is full new msgs are lost, not old ones */
+	FDCAN1->RXF0C |= (CAN_RX_FIFO0_WATERMARK << FDCAN_RXF0C_F0WM_Pos);
 		
 	/* Rx FIFO 1 start address */
 	RxFIFO1SA = RxFIFO0SA + (CAN_RX_FIFO0_ELMTS_NBR * CAN_RX_FIFO0_ELMTS_SIZE);
@@ -150,7 +176,7 @@ uint16_t InitCAN1 (uint32_t *idArray)
 	FDCAN1->TXBC |= (TxBufferSA << FDCAN_TXBC_TBSA_Pos);
 	/* Dedicated Tx buffers number */
 	FDCAN1->TXBC |= (CAN_TX_BUFFERS_NBR << FDCAN_TXBC_NDTB_Pos);
-	/* Tx FIFO/queue elements number */
+	/* Tx FIFO/queue elements number, FIFO mode (TFQM = 0): msgs are sent in order they were put */
 	FDCAN1->TXBC |= (CAN_TX_FIFO_QUEUE_ELMTS_NBR << FDCAN_TXBC_TFQS_Pos);
 
 	/* Tx FIFO/queue start address */
@@ -168,7 +194,10 @@ uint16_t InitCAN1 (uint32_t *idArray)
 
 	EndAddress = TxFIFOQSA + (CAN_TX_FIFO_QUEUE_ELMTS_NBR * CAN_TX_ELMTS_SIZE * 4);
 
-	if(EndAddress > 0x4000B5FC) /* Last address of the Message RAM */
+	txStat.queued = 0;
+	txStat.confirmed = 0;
+
+	if(EndAddress > CAN_MSG_RAM_END_ADDRESS)
 	{
 		/* Update error code. Message RAM overflow */
 		return CAN_STATUS_ERROR_RAM;
@@ -188,6 +217,16 @@ uint16_t InitCAN1 (uint32_t *idArray)
 	/* Set configuration of Rx & Tx filters */
 	Config_RxFilters(idArray);
 	Config_TxFilters();
+
+	/* Rx FIFO 0 watermark and message lost interrupts on line 0. Single msgs (commands) are
+	 * taken from FIFO by main loop, interrupt empties FIFO when main loop is busy */
+	rxRingHead = 0;
+	rxRingTail = 0;
+	FDCAN1->ILS = 0;
+	FDCAN1->IE = FDCAN_IE_RF0WE | FDCAN_IE_RF0LE;
+	FDCAN1->ILE = FDCAN_ILE_EINT0;
+	NVIC_SetPriority(FDCAN1_IT0_IRQn, CAN1_IRQ_PRIORITY);
+	NVIC_EnableIRQ(FDCAN1_IT0_IRQn);
 		
 	/* Request leave initialization */
 	FDCAN1->CCCR &= ~FDCAN_CCCR_INIT;
@@ -207,144 +246,318 @@ uint16_t InitCAN1 (uint32_t *idArray)
 
 
 
+/* ---------------------------- DeInitCAN1 -----------------------------------*/
+void DeInitCAN1 (void)
+{
+	/* FDCAN1 interrupt must not reach user program before it makes its own CAN init */
+	FDCAN1->ILE = 0;
+	FDCAN1->IE = 0;
+	NVIC_DisableIRQ(FDCAN1_IT0_IRQn);
+	NVIC_ClearPendingIRQ(FDCAN1_IT0_IRQn);
+}
+/* -------------------------- End DeInitCAN1 ---------------------------------*/
+
+
+
 	
 /* ------------------------- ReceiveCanMsg -----------------------------------*/
-void ReceiveCanMsg (uint32_t RxLocation, uint8_t *pRxData, uint16_t CanModule)
+uint8_t ReceiveCanMsg (uint32_t RxLocation, FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData, uint16_t CanModule)
 {
-	FDCAN_RxHeaderTypeDef pRxHeader;
 	uint32_t *RxAddress;
-	uint8_t  *pData;
-	uint32_t ByteCounter;
-	// uint32_t GetIndex = 0;
+	uint8_t length;
 	
 	
 	/* Calculate Rx buffer address */
 	RxAddress = (uint32_t *)(RxBufferSA + (RxLocation * CAN_RX_BUFFERS_SIZE * 4));
+
+	length = ReadRxElement(RxAddress, pRxHeader, pRxData);
+ 
+	/* Clear the New Data flag of the current Rx buffer */
+	if (CanModule == CAN_MODULE1)
+	{
+		//FDCAN1->NDAT1 = (1 << RxLocation);
+		if(RxLocation < 32)
+		{
+			FDCAN1->NDAT1 = (1 << RxLocation);
+		}
+		else /* 32 <= RxBufferIndex <= 63 */
+		{
+			FDCAN1->NDAT2 = (1 << (RxLocation - 0x20));
+		}
+	}
+	else
+	{
+		if(RxLocation < 32)
+		{
+			FDCAN2->NDAT1 = (1 << RxLocation);
+		}
+		else /* 32 <= RxBufferIndex <= 63 */
+		{
+			FDCAN2->NDAT2 = (1 << (RxLocation - 0x20));
+		}
 	
+	}
+
+	return length;
+
+}
+/* ----------------------- End ReceiveCanMsg ---------------------------------*/
+
+
+
+/* ------------------------- ReadRxElement -----------------------------------*/
+uint8_t ReadRxElement (uint32_t *RxAddress, FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData)
+{
+	uint8_t  *pData;
+	uint32_t ByteCounter;
+
 	/* Retrieve IdType */
-	pRxHeader.IdType = *RxAddress & FDCAN_ELEMENT_MASK_XTD;
+	pRxHeader->IdType = *RxAddress & FDCAN_ELEMENT_MASK_XTD;
 
 	/* Retrieve Identifier */
-	pRxHeader.Identifier = ((*RxAddress & FDCAN_ELEMENT_MASK_STDID) >> 18);
+	pRxHeader->Identifier = ((*RxAddress & FDCAN_ELEMENT_MASK_STDID) >> 18);
 
 	/* Retrieve RxFrameType */
-	pRxHeader.RxFrameType = (*RxAddress & FDCAN_ELEMENT_MASK_RTR);
+	pRxHeader->RxFrameType = (*RxAddress & FDCAN_ELEMENT_MASK_RTR);
 
 	/* Retrieve ErrorStateIndicator */
-	pRxHeader.ErrorStateIndicator = (*RxAddress++ & FDCAN_ELEMENT_MASK_ESI);
+	pRxHeader->ErrorStateIndicator = (*RxAddress++ & FDCAN_ELEMENT_MASK_ESI);
 
 	/* Retrieve RxTimestamp */
-	pRxHeader.RxTimestamp = (*RxAddress & FDCAN_ELEMENT_MASK_TS);
+	pRxHeader->RxTimestamp = (*RxAddress & FDCAN_ELEMENT_MASK_TS);
 
 	/* Retrieve DataLength */
-	pRxHeader.DataLength = (*RxAddress & FDCAN_ELEMENT_MASK_DLC);
+	pRxHeader->DataLength = (*RxAddress & FDCAN_ELEMENT_MASK_DLC);
 
 	/* Retrieve BitRateSwitch */
-	pRxHeader.BitRateSwitch = (*RxAddress & FDCAN_ELEMENT_MASK_BRS);
+	pRxHeader->BitRateSwitch = (*RxAddress & FDCAN_ELEMENT_MASK_BRS);
 
 	/* Retrieve FDFormat */
-	pRxHeader.FDFormat = (*RxAddress & FDCAN_ELEMENT_MASK_FDF);
+	pRxHeader->FDFormat = (*RxAddress & FDCAN_ELEMENT_MASK_FDF);
 
 	/* Retrieve FilterIndex */
-	pRxHeader.FilterIndex = ((*RxAddress & FDCAN_ELEMENT_MASK_FIDX) >> 24);
+	pRxHeader->FilterIndex = ((*RxAddress & FDCAN_ELEMENT_MASK_FIDX) >> 24);
 
 	/* Retrieve NonMatchingFrame */
-	pRxHeader.IsFilterMatchingFrame = ((*RxAddress++ & FDCAN_ELEMENT_MASK_ANMF) >> 31);
+	pRxHeader->IsFilterMatchingFrame = ((*RxAddress++ & FDCAN_ELEMENT_MASK_ANMF) >> 31);
 
 	/* Retrieve Rx payload */
 	pData = (uint8_t *)RxAddress;
-	for(ByteCounter = 0; ByteCounter < DLCtoBytes[pRxHeader.DataLength >> 16]; ByteCounter++)
+	for(ByteCounter = 0; ByteCounter < DLCtoBytes[pRxHeader->DataLength >> 16]; ByteCounter++)
 	{
       *pRxData++ = *pData++;
 	}
- 
-	/* Clear the New Data flag of the current Rx buffer */
-	if (CanModule == CAN_MODULE1)
+
+	return DLCtoBytes[pRxHeader->DataLength >> 16];
+}
+/* ----------------------- End ReadRxElement ---------------------------------*/
+
+
+
+/* ---------------------- FDCAN1_IT0_IRQHandler ------------------------------*/
+void FDCAN1_IT0_IRQHandler (void)
+{
+	uint32_t flags = FDCAN1->IR & (FDCAN_IR_RF0W | FDCAN_IR_RF0L);
+
+	FDCAN1->IR = flags;
+
+	if (flags & FDCAN_IR_RF0L)
 	{
-		//FDCAN1->NDAT1 = (1 << RxLocation);
-		if(RxLocation < 32)
-		{
-			FDCAN1->NDAT1 = (1 << RxLocation);
-		}
-		else /* 32 <= RxBufferIndex <= 63 */
-		{
-			FDCAN1->NDAT2 = (1 << (RxLocation - 0x20));
-		}
+		rxStat.fifoLost++;
 	}
-	else
+
+	CAN1_RxFifoDrain();
+}
+/* -------------------- End FDCAN1_IT0_IRQHandler ----------------------------*/
+
+
+
+/* ------------------------ CAN1_RxFifoDrain ---------------------------------*/
+void CAN1_RxFifoDrain (void)
+{
+	uint32_t GetIndex;
+	uint32_t FillLevel;
+	uint32_t head;
+	typeDefCanRxFrame *pFrame;
+
+	/* Move msgs from Rx FIFO 0 to the ring. It is called by interrupt or by main loop with this
+	 * interrupt disabled, so there is only one writer of 'rxRingHead'. Main loop is the only
+	 * writer of 'rxRingTail' */
+	FillLevel = (FDCAN1->RXF0S & FDCAN_RXF0S_F0FL) >> FDCAN_RXF0S_F0FL_Pos;
+	if (FillLevel > rxStat.fifoMaxLevel){rxStat.fifoMaxLevel = FillLevel;}
+
+	while (FillLevel != 0)
 	{
-		if(RxLocation < 32)
-		{
-			FDCAN2->NDAT1 = (1 << RxLocation);
-		}
-		else /* 32 <= RxBufferIndex <= 63 */
+		head = rxRingHead;
+		if ((head - rxRingTail) >= CAN_RX_RING_SIZE)
 		{
-			FDCAN2->NDAT2 = (1 << (RxLocation - 0x20));
+			/* msgs stay in FIFO until main loop frees the ring */
+			rxStat.ringFull++;
+			return;
 		}
-	
+
+		GetIndex = (FDCAN1->RXF0S & FDCAN_RXF0S_F0GI) >> FDCAN_RXF0S_F0GI_Pos;
+		pFrame = &rxRing[head & (CAN_RX_RING_SIZE - 1)];
+		pFrame->length = ReadRxElement((uint32_t *)(RxFIFO0SA + (GetIndex * CAN_RX_FIFO0_ELMTS_SIZE * 4)), &pFrame->header, pFrame->data);
+
+		__DMB();				// frame is written before it becomes visible for main loop
+		rxRingHead = head + 1;
+
+		/* Acknowledge the element, FDCAN can use it again */
+		FDCAN1->RXF0A = GetIndex;
+
+		FillLevel = (FDCAN1->RXF0S & FDCAN_RXF0S_F0FL) >> FDCAN_RXF0S_F0FL_Pos;
 	}
-    
+}
+/* ---------------------- End CAN1_RxFifoDrain -------------------------------*/
+
+
 
+/* --------------------------- CAN1_RxPoll -----------------------------------*/
+void CAN1_RxPoll (void)
+{
+	/* Below watermark there is no interrupt, so main loop takes msgs itself */
+	NVIC_DisableIRQ(FDCAN1_IT0_IRQn);
+	CAN1_RxFifoDrain();
+	NVIC_EnableIRQ(FDCAN1_IT0_IRQn);
 }
-/* ----------------------- End ReceiveCanMsg ---------------------------------*/
+/* ------------------------- End CAN1_RxPoll ---------------------------------*/
+
+
 
+/* ------------------------- CAN1_GetRxStat ----------------------------------*/
+typeDefCanRxStat CAN1_GetRxStat (void)
+{
+	return rxStat;
+}
+/* ----------------------- End CAN1_GetRxStat --------------------------------*/
 
 
 
-/* ----------------------- FDCAN_SendMessage ---------------------------------*/
- void FDCAN_SendMessage(FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData, uint32_t BufferIndex, uint16_t CanModule)
+/* ------------------------- CAN1_RxRingPop ----------------------------------*/
+uint16_t CAN1_RxRingPop (typeDefCanRxFrame *pFrame)
 {
-  if (!((FDCAN1->TXBRP) & (1 << BufferIndex)) )  // check transmit pending
-  {
-	
-  uint32_t TxElementW1 =0;
-  uint32_t TxElementW2=0;
-  uint32_t *TxAddress;
-  uint32_t ByteCounter;
-
-  /* Build first word of Tx header element */
-  TxElementW1 = (pTxHeader->ErrorStateIndicator |
-                   FDCAN_STANDARD_ID |
-                   pTxHeader->TxFrameType |
-                   (pTxHeader->Identifier << 18));
-
-  /* Build second word of Tx header element */
-  TxElementW2 = ((pTxHeader->MessageMarker << 24) |
-                 pTxHeader->TxEventFifoControl |
-                 pTxHeader->FDFormat |
-                 pTxHeader->BitRateSwitch |
-                 pTxHeader->DataLength);
-
-  /* Calculate Tx element address */
- 	TxAddress = (uint32_t *)(TxBufferSA + (POSITION_VAL(BufferIndex) * CAN_TX_ELMTS_SIZE * 4));
-	
-  /* Write Tx element header to the message RAM */
-  *TxAddress++ = TxElementW1;
-  *TxAddress++ = TxElementW2;
+	uint32_t tail = rxRingTail;
 
-  /* Write Tx payload to the message RAM */
-  for(ByteCounter = 0; ByteCounter < DLCtoBytes[pTxHeader->DataLength >> 16]; ByteCounter += 4)
-  {
-    *TxAddress++ = ((pTxData[ByteCounter+3] << 24) |
-                    (pTxData[ByteCounter+2] << 16) |
-                    (pTxData[ByteCounter+1] << 8) |
-                    pTxData[ByteCounter]);
-  }
+	if (tail == rxRingHead){return 0;}		// ring is empty
 
+	__DMB();								// read the frame only after the head was read
+	*pFrame = rxRing[tail & (CAN_RX_RING_SIZE - 1)];
+	__DMB();
+	rxRingTail = tail + 1;
 
-	/* Add transmission request */
-	
-	if (CanModule == CAN_MODULE1){
-		 FDCAN1->TXBAR = BufferIndex;
+	return 1;
+}
+/* ----------------------- End CAN1_RxRingPop --------------------------------*/
+
+
+
+
+/* ------------------------- FDCAN_SendFifo ----------------------------------*/
+uint16_t FDCAN_SendFifo(FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData, uint16_t CanModule)
+{
+	/* Msg is put to Tx FIFO. If FIFO is full it returns CAN_STATUS_ERROR and the caller
+	 * keeps the msg to send it again, so no answer is dropped */
+	FDCAN_GlobalTypeDef *fdcan = (CanModule == CAN_MODULE1) ? FDCAN1 : FDCAN2;
+	uint32_t PutIndex;
+
+	if (fdcan->TXFQS & FDCAN_TXFQS_TFQF)
+	{
+		txStat.fifoFull++;
+		return CAN_STATUS_ERROR;
+	}
+
+	PutIndex = (fdcan->TXFQS & FDCAN_TXFQS_TFQPI) >> FDCAN_TXFQS_TFQPI_Pos;
+
+	/* there are no dedicated Tx buffers (CAN_TX_BUFFERS_NBR = 0), put index is the element of Tx FIFO */
+	WriteTxElement((uint32_t *)(TxBufferSA + (PutIndex * CAN_TX_ELMTS_SIZE * 4)), pTxHeader, pTxData);
+
+	fdcan->TXBAR = (1UL << PutIndex);
+	txStat.queued++;
+
+	return CAN_STATUS_OK;
+}
+/* ----------------------- End FDCAN_SendFifo --------------------------------*/
+
+
+/* ------------------------ FDCAN_TxFifoFree ---------------------------------*/
+uint8_t FDCAN_TxFifoFree(uint16_t CanModule)
+{
+	FDCAN_GlobalTypeDef *fdcan = (CanModule == CAN_MODULE1) ? FDCAN1 : FDCAN2;
+
+	return (uint8_t)((fdcan->TXFQS & FDCAN_TXFQS_TFFL) >> FDCAN_TXFQS_TFFL_Pos);
+}
+/* ---------------------- End FDCAN_TxFifoFree -------------------------------*/
+
+
+/* ------------------------- WriteTxElement ----------------------------------*/
+void WriteTxElement (uint32_t *TxAddress, FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData)
+{
+	uint32_t ByteCounter;
+
+	/* Build first word of Tx header element */
+	*TxAddress++ = (pTxHeader->ErrorStateIndicator |
+                    FDCAN_STANDARD_ID |
+                    pTxHeader->TxFrameType |
+                    (pTxHeader->Identifier << 18));
+
+	/* Build second word of Tx header element */
+	*TxAddress++ = ((pTxHeader->MessageMarker << 24) |
+                    pTxHeader->TxEventFifoControl |
+                    pTxHeader->FDFormat |
+                    pTxHeader->BitRateSwitch |
+                    pTxHeader->DataLength);
+
+	/* Write Tx payload to the message RAM */
+	for(ByteCounter = 0; ByteCounter < DLCtoBytes[pTxHeader->DataLength >> 16]; ByteCounter += 4)
+	{
+		*TxAddress++ = ((pTxData[ByteCounter+3] << 24) |
+                        (pTxData[ByteCounter+2] << 16) |
+                        (pTxData[ByteCounter+1] << 8) |
+                        pTxData[ByteCounter]);
 	}
-	else{
-		 FDCAN2->TXBAR = BufferIndex;
+}
+/* ----------------------- End WriteTxElement --------------------------------*/
+
+
+/* ------------------------ CAN1_TxEventPoll ---------------------------------*/
+void CAN1_TxEventPoll (void)
+{
+	/* Main loop: every msg sent from Tx FIFO leaves an event, it confirms that the msg is on the bus */
+	uint32_t GetIndex;
+
+	while ((FDCAN1->TXEFS & FDCAN_TXEFS_EFFL) != 0)
+	{
+		GetIndex = (FDCAN1->TXEFS & FDCAN_TXEFS_EFGI) >> FDCAN_TXEFS_EFGI_Pos;
+		txStat.confirmed++;
+		FDCAN1->TXEFA = GetIndex;
 	}
-	
+
+	/* lost events (should not happen, event FIFO is as long as Tx FIFO): count is taken from Tx FIFO */
+	if (FDCAN1->IR & FDCAN_IR_TEFL)
+	{
+		FDCAN1->IR = FDCAN_IR_TEFL;
+		txStat.confirmed = txStat.queued - (CAN_TX_FIFO_QUEUE_ELMTS_NBR - FDCAN_TxFifoFree(CAN_MODULE1));
 	}
+}
+/* ---------------------- End CAN1_TxEventPoll -------------------------------*/
+
+
+/* ------------------------- CAN1_TxPending ----------------------------------*/
+uint32_t CAN1_TxPending (void)
+{
+	/* msgs which are queued but not confirmed yet */
+	return txStat.queued - txStat.confirmed;
+}
+/* ----------------------- End CAN1_TxPending --------------------------------*/
+
 
+/* ------------------------- CAN1_GetTxStat ----------------------------------*/
+typeDefCanTxStat CAN1_GetTxStat (void)
+{
+	return txStat;
 }
-/* --------------------- End FDCAN_SendMessage -------------------------------*/
+/* ----------------------- End CAN1_GetTxStat --------------------------------*/
 
 
 /* -------------------- RxFilterRegisterConfig -------------------------------*/
@@ -353,10 +566,20 @@ void RxFilterRegisterConfig (FDCAN_FilterTypeDef *pRxFilter)
  	uint32_t FilterElementW1;
  	uint32_t *FilterAddress;
 
- 	FilterElementW1 = ((FDCAN_FILTER_TO_RXBUFFER << 27)       |
-                       (pRxFilter->FilterID1 << 16)       |
-                       (pRxFilter->IsCalibrationMsg << 8) |
-                        pRxFilter->RxBufferIndex            );
+ 	if (pRxFilter->FilterConfig == FDCAN_FILTER_TO_RXBUFFER)
+ 	{
+ 		FilterElementW1 = ((FDCAN_FILTER_TO_RXBUFFER << 27)       |
+                           (pRxFilter->FilterID1 << 16)       |
+                           (pRxFilter->IsCalibrationMsg << 8) |
+                            pRxFilter->RxBufferIndex            );
+ 	}
+ 	else
+ 	{
+ 		FilterElementW1 = ((pRxFilter->FilterType << 30)   |
+                           (pRxFilter->FilterConfig << 27) |
+                           (pRxFilter->FilterID1 << 16)    |
+                            pRxFilter->FilterID2            );
+ 	}
 
  	/* Calculate filter address */
  	FilterAddress = (uint32_t *)(StdFilterSA + (pRxFilter->FilterIndex * 4));
@@ -375,30 +598,46 @@ void Config_RxFilters(uint32_t *idArray)
 	uint32_t index;
 
 
+	/* Commands and program text go to the same Rx FIFO 0, so they are read in the order
+	 * they were received (0xCC always comes after the last msg 0x57x of its block).
+	 * idArray: 0x56x, 0x57x, group commands, group program text - the second id of dual filters, ISO-TP */
+
 	/* Configure Rx filter Msg ID 0x56x */
-	index = FDCAN_RX_BUFFER0;
-	headerRxMsg_0x56x.RxBufferIndex = index;
+	index = 0;
+	headerRxMsg_0x56x.RxBufferIndex = 0;
 	headerRxMsg_0x56x.FilterIndex = index;
 	headerRxMsg_0x56x.IdType = FDCAN_STANDARD_ID;
 	headerRxMsg_0x56x.FilterType = FDCAN_FILTER_DUAL;
-	headerRxMsg_0x56x.FilterConfig = FDCAN_FILTER_TO_RXBUFFER;
+	headerRxMsg_0x56x.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
 	headerRxMsg_0x56x.FilterID1 = idArray[index];
-	headerRxMsg_0x56x.FilterID2 = 0x00;
+	headerRxMsg_0x56x.FilterID2 = idArray[2];
 
 	RxFilterRegisterConfig(&headerRxMsg_0x56x);
 
 	/* Configure Rx filter Msg ID 0x57x */
-	index = FDCAN_RX_BUFFER1;
-	headerRxMsg_0x57x.RxBufferIndex = index;
+	index = 1;
+	headerRxMsg_0x57x.RxBufferIndex = 0;
 	headerRxMsg_0x57x.FilterIndex = index;
 	headerRxMsg_0x57x.IdType = FDCAN_STANDARD_ID;
 	headerRxMsg_0x57x.FilterType = FDCAN_FILTER_DUAL;
-	headerRxMsg_0x57x.FilterConfig = FDCAN_FILTER_TO_RXBUFFER;
+	headerRxMsg_0x57x.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
 	headerRxMsg_0x57x.FilterID1 = idArray[index];
-	headerRxMsg_0x57x.FilterID2 = 0x00;
+	headerRxMsg_0x57x.FilterID2 = idArray[3];
 
 	RxFilterRegisterConfig(&headerRxMsg_0x57x);
 
+	/* Configure Rx filter of ISO-TP frames */
+	index = 2;
+	headerRxMsg_IsoTp.RxBufferIndex = 0;
+	headerRxMsg_IsoTp.FilterIndex = index;
+	headerRxMsg_IsoTp.IdType = FDCAN_STANDARD_ID;
+	headerRxMsg_IsoTp.FilterType = FDCAN_FILTER_DUAL;
+	headerRxMsg_IsoTp.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
+	headerRxMsg_IsoTp.FilterID1 = idArray[4];
+	headerRxMsg_IsoTp.FilterID2 = idArray[4];
+
+	RxFilterRegisterConfig(&headerRxMsg_IsoTp);
+
 
 }
 /* --------------------- End Config_RxFilters --------------------------------*/
@@ -417,8 +656,8 @@ void Config_TxFilters (void)
 	headerTxMsg_0x550.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
 	headerTxMsg_0x550.BitRateSwitch = FDCAN_BRS_OFF;
 	headerTxMsg_0x550.FDFormat = FDCAN_CLASSIC_CAN;
-	headerTxMsg_0x550.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-	headerTxMsg_0x550.MessageMarker = headerTxMsg_0x550.Identifier;
+	headerTxMsg_0x550.TxEventFifoControl = FDCAN_STORE_TX_EVENTS;
+	headerTxMsg_0x550.MessageMarker = headerTxMsg_0x550.Identifier & 0xFF;
 
 	headerTxMsg_0x551.Identifier = 0x551;
 	headerTxMsg_0x551.IdType = FDCAN_STANDARD_ID;
@@ -427,8 +666,8 @@ void Config_TxFilters (void)
 	headerTxMsg_0x551.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
 	headerTxMsg_0x551.BitRateSwitch = FDCAN_BRS_OFF;
 	headerTxMsg_0x551.FDFormat = FDCAN_CLASSIC_CAN;
-	headerTxMsg_0x551.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-	headerTxMsg_0x551.MessageMarker = headerTxMsg_0x551.Identifier;
+	headerTxMsg_0x551.TxEventFifoControl = FDCAN_STORE_TX_EVENTS;
+	headerTxMsg_0x551.MessageMarker = headerTxMsg_0x551.Identifier & 0xFF;
 
 	headerTxMsg_0x555.Identifier = 0x555;
 	headerTxMsg_0x555.IdType = FDCAN_STANDARD_ID;
@@ -437,10 +676,27 @@ void Config_TxFilters (void)
 	headerTxMsg_0x555.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
 	headerTxMsg_0x555.BitRateSwitch = FDCAN_BRS_OFF;
 	headerTxMsg_0x555.FDFormat = FDCAN_CLASSIC_CAN;
-	headerTxMsg_0x555.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-	headerTxMsg_0x555.MessageMarker = headerTxMsg_0x555.Identifier;
+	headerTxMsg_0x555.TxEventFifoControl = FDCAN_STORE_TX_EVENTS;
+	headerTxMsg_0x555.MessageMarker = headerTxMsg_0x555.Identifier & 0xFF;
 
 
 }
 /* --------------------- End Config_TxFilters --------------------------------*/
 
+
+
+/* ---------------------- Config_TxFrameFormat ------------------------------*/
+void Config_TxFrameFormat (uint32_t FDFormat, uint32_t BitRateSwitch)
+{
+	/* answers are sent in the same format as the host uses (classic or CAN-FD) */
+	headerTxMsg_0x550.FDFormat = FDFormat;
+	headerTxMsg_0x550.BitRateSwitch = BitRateSwitch;
+
+	headerTxMsg_0x551.FDFormat = FDFormat;
+	headerTxMsg_0x551.BitRateSwitch = BitRateSwitch;
+
+	headerTxMsg_0x555.FDFormat = FDFormat;
+	headerTxMsg_0x555.BitRateSwitch = BitRateSwitch;
+}
+/* -------------------- End Config_TxFrameFormat ----------------------------*/
+
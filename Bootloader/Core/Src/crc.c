@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file           : crc.c
+  * @brief          : CRC32 by hardware CRC unit of STM32H743
+  ******************************************************************************
+  *
+  * CRC32 is the same as in zip/zlib (polynomial 0x04C11DB7, reflected input
+  * and output, init and final xor 0xFFFFFFFF), so host can use any standard
+  * implementation. Data is fed by 32-bit words.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "crc.h"
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* ---------------------------- CrcInit --------------------------------------*/
+void CrcInit(void)
+{
+	RCC->AHB4ENR |= RCC_AHB4ENR_CRCEN;
+	__DSB();
+
+	CRC->POL = 0x04C11DB7;
+	CRC->INIT = CRC32_INIT;
+	CRC->CR = CRC_CR_REV_IN | CRC_CR_REV_OUT;	// bit reversal of 32-bit input words and of output, 32-bit polynomial
+}
+/* -------------------------- End CrcInit ------------------------------------*/
+
+
+
+/* ---------------------------- CrcCalc32 ------------------------------------*/
+uint32_t CrcCalc32(uint32_t address, uint32_t size)
+{
+	/* 'address' - 32-bit aligned, 'size' - multiple of 4 bytes */
+	__IO uint32_t *data = (__IO uint32_t *)address;
+
+	CRC->CR |= CRC_CR_RESET;
+
+	for (uint32_t i = 0; i < size / 4; i++)
+	{
+		CRC->DR = data[i];
+	}
+
+	return CRC->DR ^ CRC32_XOR_OUT;
+}
+/* -------------------------- End CrcCalc32 ----------------------------------*/
@@ -0,0 +1,123 @@
+/**
+  ******************************************************************************
+  * @file           : delta.c
+  * @brief          : Rebuilding of new image from the old one and delta (bsdiff)
+  ******************************************************************************
+  *
+  * Delta is a sequence of bsdiff entries, each of them is sent as:
+  *   - diff length (uint32), extra length (uint32), old seek (int32), little-endian;
+  *   - diff bytes: new byte = old byte + diff byte, old position goes forward;
+  *   - extra bytes: new byte = extra byte.
+  * After an entry old position is moved by 'old seek'. This is the bsdiff patch
+  * with control, diff and extra streams interleaved and not compressed, so it can
+  * be decoded in streaming fashion.
+  *
+  * Old image is read by ProgReadOld: flash is rewritten sector by sector, so delta
+  * can refer to old data of the current output sector, of the previous one (it is
+  * in scratch sector) and of any sector after them.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "delta.h"
+#include "prog.h"
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static enum DELTA_STATE deltaState;
+static uint8_t ctrl[DELTA_CTRL_SIZE];
+static uint8_t ctrlLen;
+static uint32_t diffLen;
+static uint32_t extraLen;
+static int32_t oldSeek;
+static uint32_t oldPos;					// offset in old image from APP_PROG_ADDRESS
+static uint8_t deltaFailed;
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* DeltaStart ----------------------------------------------------------------*/
+void DeltaStart(void)
+{
+	deltaState = DELTA_ST_CTRL;
+	ctrlLen = 0;
+	oldPos = 0;
+	deltaFailed = 0;
+}
+/* End DeltaStart ------------------------------------------------------------*/
+
+
+
+/* DeltaFailed ---------------------------------------------------------------*/
+uint8_t DeltaFailed(void)
+{
+	/* delta refers to old data which is already erased */
+	return deltaFailed;
+}
+/* End DeltaFailed -----------------------------------------------------------*/
+
+
+
+/* DeltaDecode ---------------------------------------------------------------*/
+uint16_t DeltaDecode(const uint8_t *pIn, uint16_t inSize, uint8_t *pOut, uint16_t outSize, uint16_t *pOutLen)
+{
+	/* Decodes until input is over or output is full, returns number of used input bytes */
+	uint16_t inPos = 0;
+	uint16_t outPos = 0;
+	uint8_t old;
+
+	while ( (inPos < inSize) && !deltaFailed )
+	{
+		switch (deltaState)
+		{
+			case DELTA_ST_CTRL:
+				ctrl[ctrlLen++] = pIn[inPos++];
+				if (ctrlLen < DELTA_CTRL_SIZE){break;}
+
+				ctrlLen = 0;
+				diffLen = ctrl[0] | (ctrl[1] << 8) | (ctrl[2] << 16) | ((uint32_t)ctrl[3] << 24);
+				extraLen = ctrl[4] | (ctrl[5] << 8) | (ctrl[6] << 16) | ((uint32_t)ctrl[7] << 24);
+				oldSeek = (int32_t)(ctrl[8] | (ctrl[9] << 8) | (ctrl[10] << 16) | ((uint32_t)ctrl[11] << 24));
+				deltaState = DELTA_ST_DIFF;
+				break;
+
+			case DELTA_ST_DIFF:
+				if (diffLen == 0){deltaState = DELTA_ST_EXTRA; break;}
+				if (outPos >= outSize){*pOutLen = outPos; return inPos;}
+
+				if (!ProgReadOld(oldPos, &old)){deltaFailed = 1; break;}
+				pOut[outPos++] = old + pIn[inPos++];
+				oldPos++;
+				diffLen--;
+				break;
+
+			case DELTA_ST_EXTRA:
+				if (extraLen == 0)
+				{
+					oldPos += oldSeek;
+					deltaState = DELTA_ST_CTRL;
+					break;
+				}
+				if (outPos >= outSize){*pOutLen = outPos; return inPos;}
+
+				pOut[outPos++] = pIn[inPos++];
+				extraLen--;
+				break;
+		}
+	}
+
+	/* entry with empty extra part is finished without next input byte */
+	if ( (deltaState == DELTA_ST_DIFF) && (diffLen == 0) && (extraLen == 0) )
+	{
+		oldPos += oldSeek;
+		deltaState = DELTA_ST_CTRL;
+	}
+
+	*pOutLen = outPos;
+	return inPos;
+}
+/* End DeltaDecode -----------------------------------------------------------*/
@@ -4,8 +4,20 @@
   * @brief          : Flash memory configuration for STM32H743
   ******************************************************************************
   *
-  * Only BANK1 is used. For using BANK2 create functions that calling registers
-  * with index '2'.
+  * Both banks are described by geometry table 'flashBank': Sector0..Sector7 - BANK1,
+  * Sector8..Sector15 - BANK2, every bank has its own registers (CR1/SR1/KEYR1/CCR1
+  * and CR2/SR2/KEYR2/CCR2). Erase picks the bank by sector number, write - by address
+  * (flash_GetBank), so an image can go on from BANK1 to BANK2.
+  * BANK2 also holds the inactive slot of A/B update: flashSwapBanks toggles option
+  * byte SWAP_BANK, after reset the banks change places.
+  *
+  * Blocking functions (flashWrite, flash_EraseSector) wait for the end of operation.
+  * Non-blocking ones (flashSubmitWrite, flashSubmitErase) only start an operation,
+  * it is advanced by flashProcess which is called from main loop and returns an
+  * event when the operation is completed or failed. Sector erase takes about 1 sec,
+  * meanwhile bootloader keeps servicing CAN.
+  * Every bank has its own operation ('flashOp'): BANK1 and BANK2 are erased and
+  * programmed at the same time, flashProcess feeds the write buffer of each bank.
   *
   ******************************************************************************
   */
@@ -17,52 +29,130 @@
 #include "stm32h7xx.h"
 
 /* Defines -------------------------------------------------------------------*/
+
+enum FLASH_STATE{FLASH_ST_IDLE, FLASH_ST_ERASE, FLASH_ST_WRITE};
+
+/* non-blocking operation of one bank */
+typedef struct
+{
+	enum FLASH_STATE state;
+	enum FLASH_STATUS error;
+	__IO uint8_t *dest;
+	uint8_t *src;
+	uint32_t remain;						// bytes which are not loaded to write buffer yet
+}flashOpTypeDef;
+
 /* Variables -----------------------------------------------------------------*/
 
+/* not const: constants stay in flash, the table is read while BANK1 is busy */
+static typeDefFlashBank flashBank[FLASH_BANKS] =
+{
+	{ADDR_FLASH_SECTOR_0_BANK1, Sector0, &FLASH->KEYR1, &FLASH->CR1, &FLASH->SR1, &FLASH->CCR1},
+	{ADDR_FLASH_SECTOR_0_BANK2, Sector8, &FLASH->KEYR2, &FLASH->CR2, &FLASH->SR2, &FLASH->CCR2}
+};
+
+/* the banks have own controllers: every bank has its own non-blocking operation */
+static flashOpTypeDef flashOp[FLASH_BANKS];
+
 
 /* Functions -----------------------------------------------------------------*/
 
 /* flashUnlock ---------------------------------------------------------------*/
 enum FLASH_STATUS flashUnlock(void)
+{
+	return flashBankUnlock(&flashBank[0]);
+}
+/* End flashUnlock -----------------------------------------------------------*/
+
+
+
+/* flashLock -----------------------------------------------------------------*/
+enum FLASH_STATUS flashLock(void)
+{
+	return flashBankLock(&flashBank[0]);
+}
+/* End flashLock -------------------------------------------------------------*/
+
+
+
+/* flashBankUnlock -----------------------------------------------------------*/
+enum FLASH_STATUS flashBankUnlock(const typeDefFlashBank *pBank)
 {
 
-	if(READ_BIT(FLASH->CR1, FLASH_CR_LOCK) != 0U)
+	if(READ_BIT(*pBank->CR, FLASH_CR_LOCK) != 0U)
 	{
-	    /* Authorize the FLASH Bank1 Registers access */
-	    WRITE_REG(FLASH->KEYR1, 0x45670123);
-	    WRITE_REG(FLASH->KEYR1, 0xCDEF89AB);
+	    /* Authorize the FLASH Bank Registers access */
+	    WRITE_REG(*pBank->KEYR, 0x45670123);
+	    WRITE_REG(*pBank->KEYR, 0xCDEF89AB);
 
-	    /* Verify Flash Bank1 is unlocked */
-	    if (READ_BIT(FLASH->CR1, FLASH_CR_LOCK) != 0U){
+	    /* Verify Flash Bank is unlocked */
+	    if (READ_BIT(*pBank->CR, FLASH_CR_LOCK) != 0U){
 	    	return FLASH_LOCK_ERROR;
 	    }
 	}
 
 	return FLASH_RDY;
 }
-/* End flashUnlock -----------------------------------------------------------*/
+/* End flashBankUnlock -------------------------------------------------------*/
 
 
 
-/* flashLock -----------------------------------------------------------------*/
-enum FLASH_STATUS flashLock(void)
+/* flashBankLock -------------------------------------------------------------*/
+enum FLASH_STATUS flashBankLock(const typeDefFlashBank *pBank)
 {
 
-	FLASH->CR1 |= FLASH_CR_LOCK;
+	*pBank->CR |= FLASH_CR_LOCK;
 
-	/* Verify Flash Bank1 is locked */
-	if (READ_BIT(FLASH->CR1, FLASH_CR_LOCK) == 0U)
+	/* Verify Flash Bank is locked */
+	if (READ_BIT(*pBank->CR, FLASH_CR_LOCK) == 0U)
 	{
 		return FLASH_LOCK_ERROR;
 	}
 
 	return FLASH_RDY;
 }
-/* End flashLock -------------------------------------------------------------*/
+/* End flashBankLock ---------------------------------------------------------*/
+
+
+
+/* flash_GetBank -------------------------------------------------------------*/
+const typeDefFlashBank *flash_GetBank(uint32_t address)
+{
+	/* bank which contains 'address' */
+	for (uint32_t i = FLASH_BANKS - 1; i > 0; i--)
+	{
+		if (address >= flashBank[i].base){return &flashBank[i];}
+	}
+
+	return &flashBank[0];
+}
+/* End flash_GetBank ---------------------------------------------------------*/
+
+
+
+/* flash_GetSector -----------------------------------------------------------*/
+uint32_t flash_GetSector(uint32_t address)
+{
+	const typeDefFlashBank *pBank = flash_GetBank(address);
+
+	return pBank->firstSector + (address - pBank->base) / FLASH_SECTOR_SIZE;
+}
+/* End flash_GetSector -------------------------------------------------------*/
+
+
+
+/* flash_SectorAddress -------------------------------------------------------*/
+uint32_t flash_SectorAddress(uint32_t sectorNumb)
+{
+	const typeDefFlashBank *pBank = &flashBank[(sectorNumb / FLASH_SECTORS_BANK) % FLASH_BANKS];
+
+	return pBank->base + (sectorNumb - pBank->firstSector) * FLASH_SECTOR_SIZE;
+}
+/* End flash_SectorAddress ---------------------------------------------------*/
 
 
 /* flash_WaitForLastOperation ------------------------------------------------*/
-enum FLASH_STATUS flash_WaitForLastOperation(void)
+enum FLASH_STATUS flash_WaitForLastOperation(const typeDefFlashBank *pBank)
 {
 	enum FLASH_STATUS result;
 	uint32_t timeout;
@@ -70,7 +160,7 @@ enum FLASH_STATUS flash_WaitForLastOperation(void)
 
     result = FLASH_PGM_ERROR;
     timeout = 0;
-    status = FLASH->SR1;
+    status = *pBank->SR;
 
     /* Wait for the FLASH operation to complete by polling on QW flag to be reset.
        Even if the FLASH operation fails, the QW flag will be reset and an error
@@ -79,7 +169,7 @@ enum FLASH_STATUS flash_WaitForLastOperation(void)
     while((status & (FLASH_SR_BSY | FLASH_SR_WBNE | FLASH_SR_QW )) && (timeout < TIMEOUT)){
         timeout++;
         //IWDG1->KR = IWDG_RELOAD; // kick watchdog
-        status = FLASH->SR1;
+        status = *pBank->SR;
     }
 
     if (timeout < TIMEOUT){
@@ -98,10 +188,10 @@ enum FLASH_STATUS flash_WaitForLastOperation(void)
 
 
     /* Check FLASH End of Operation flag  */
-    if ( (FLASH->SR1) & FLASH_FLAG_EOP_BANK1)
+    if ( (*pBank->SR) & FLASH_FLAG_EOP_BANK1)
     {
     	/* Clear FLASH End of Operation pending bit */
-    	FLASH->CCR1 |= FLASH_CCR_CLR_EOP;;
+    	*pBank->CCR |= FLASH_CCR_CLR_EOP;;
     }
 
     return(result);
@@ -114,22 +204,27 @@ enum FLASH_STATUS flash_WaitForLastOperation(void)
 enum FLASH_STATUS   flash_EraseSector(uint32_t sectorNumb)
 {
 	enum FLASH_STATUS status;
-	if (sectorNumb > 7){return FLASH_PGM_ERROR;}
+	const typeDefFlashBank *pBank;
 
-	status = flash_WaitForLastOperation();
+	if (sectorNumb >= FLASH_SECTORS_NBR){return FLASH_PGM_ERROR;}
+
+	pBank = &flashBank[sectorNumb / FLASH_SECTORS_BANK];
+	sectorNumb -= pBank->firstSector;
+
+	status = flash_WaitForLastOperation(pBank);
 
 	if(status == FLASH_RDY)
 	{
-		flashUnlock();
-		FLASH->CR1 &= (~(FLASH_CR_PSIZE | FLASH_CR_SNB));	// clear
-		FLASH->CR1 |= (sectorNumb << FLASH_CR_SNB_Pos);		// sector erase selection number
-		FLASH->CR1 |= FLASH_CR_SER | FLASH_CR_PSIZE_1;    	// chose 'sector erase request' and  program size ( byte, half-word, word, double word)
-		FLASH->CR1 |= FLASH_CR_START; 						// erase start control bit
+		flashBankUnlock(pBank);
+		*pBank->CR &= (~(FLASH_CR_PSIZE | FLASH_CR_SNB));	// clear
+		*pBank->CR |= (sectorNumb << FLASH_CR_SNB_Pos);		// sector erase selection number
+		*pBank->CR |= FLASH_CR_SER | FLASH_CR_PSIZE_1;    	// chose 'sector erase request' and  program size ( byte, half-word, word, double word)
+		*pBank->CR |= FLASH_CR_START; 						// erase start control bit
 
-		status = flash_WaitForLastOperation();
-		FLASH->CR1 &= (~(FLASH_CR_SER | FLASH_CR_SNB));		// clear
+		status = flash_WaitForLastOperation(pBank);
+		*pBank->CR &= (~(FLASH_CR_SER | FLASH_CR_SNB));		// clear
 
-		flashLock();
+		flashBankLock(pBank);
 	}
 
 	return(status);
@@ -143,12 +238,13 @@ enum FLASH_STATUS flash_EraseAll(void)
 {
 	enum FLASH_STATUS status;
 
-    status = flash_WaitForLastOperation();
+	/* BANK1 only */
+    status = flash_WaitForLastOperation(&flashBank[0]);
     if(status == FLASH_RDY){
     	flashUnlock();
         FLASH->CR1 = FLASH_CR_BER | FLASH_CR_PSIZE_1;
         FLASH->CR1 |= FLASH_CR_START;
-        status = flash_WaitForLastOperation();
+        status = flash_WaitForLastOperation(&flashBank[0]);
         FLASH->CR1 &= ~FLASH_CR_BER;
         flashLock();
     }
@@ -176,6 +272,363 @@ enum FLASH_STATUS flashWrite( uint32_t FlashAddress, uint32_t DataAddress, int D
 	enum FLASH_STATUS status;
 
 	/* The write operations are executed in the non-volatile memory only by 256-bit data Flash word.
+	 * Full flash words are loaded by 64-bit stores (flash_LoadFlashWord), next word is loaded as soon
+	 * as write buffer is free (WBNE = 0) while previous one is still programmed (QW = 1).
+	 * Only the final partial word is forced by FW.
+	 * Area which goes on to the next bank is written by parts, every bank with its own registers.
+	 * */
+
+	__IO uint8_t *dest_addr = (__IO uint8_t *)FlashAddress;
+	uint8_t *src_addr = (uint8_t *)DataAddress;
+	uint32_t writtenBytes = 0;			// counter for bytes are already loaded to Flash
+	uint32_t loadedBytes;
+	const typeDefFlashBank *pBank = flash_GetBank(FlashAddress);
+	const typeDefFlashBank *pNextBank = flash_GetBank(FlashAddress + DataSize - 1);
+
+	if (DataSize <= 0){return FLASH_PGM_ERROR;}
+
+	if (pNextBank != pBank)
+	{
+		int firstSize = pNextBank->base - FlashAddress;
+
+		status = flashWrite(FlashAddress, DataAddress, firstSize);
+		if (status != FLASH_RDY){return status;}
+
+		return flashWrite(pNextBank->base, DataAddress + firstSize, DataSize - firstSize);
+	}
+
+	flashBankUnlock(pBank);
+
+  	/* Wait for last operation to be completed */
+  	status = flash_WaitForLastOperation(pBank);
+
+  	if(status == FLASH_RDY)
+  	{
+  		/* Enable the PG to the program operation */
+  		SET_BIT(*pBank->CR, FLASH_CR_PG);
+
+  		do
+  		{
+  			status = flash_WaitForWriteBuffer(pBank);
+  			if (status != FLASH_RDY){break;}
+
+  			loadedBytes = flash_LoadFlashWord(dest_addr, src_addr, DataSize - writtenBytes);
+  			dest_addr += loadedBytes;
+  			src_addr += loadedBytes;
+  			writtenBytes += loadedBytes;
+
+  		} while (writtenBytes < DataSize);
+
+  		/* Wait for the last flash word to be programmed */
+  		if (status == FLASH_RDY){status = flash_WaitForLastOperation(pBank);}
+
+  		/* If the program operation is completed, disable the PG */
+  		CLEAR_BIT(*pBank->CR, FLASH_CR_PG);
+
+
+  	} // if(status == FLASH_RDY)
+
+  	flashBankLock(pBank);
+
+  return status;
+}
+/* End flashWrite ------------------------------------------------------------*/
+
+
+
+/* flash_LoadFlashWord -------------------------------------------------------*/
+uint32_t flash_LoadFlashWord(__IO uint8_t *dest_addr, uint8_t *src_addr, uint32_t DataSize)
+{
+	/* Loads one flash word (or the rest of data if it is shorter) to write buffer,
+	 * returns number of loaded bytes. PG should be set.
+	 * Aligned full word - four 64-bit stores, otherwise byte by byte */
+	uint32_t startAddress = (uint32_t)dest_addr;
+	uint32_t loadedBytes = 0;
+
+	__ISB();
+	__DSB();
+
+	if ( (DataSize >= NB_8BIT_IN_FLASHWORD) && (((uint32_t)dest_addr & (NB_8BIT_IN_FLASHWORD - 1)) == 0)
+			&& (((uint32_t)src_addr & (sizeof(uint64_t) - 1)) == 0) )
+	{
+		__IO uint64_t *dest64 = (__IO uint64_t *)dest_addr;
+		uint64_t *src64 = (uint64_t *)src_addr;
+
+		dest64[0] = src64[0];
+		dest64[1] = src64[1];
+		dest64[2] = src64[2];
+		dest64[3] = src64[3];
+		loadedBytes = NB_8BIT_IN_FLASHWORD;
+	}
+	else
+	{
+		/* flash word is not aligned or it is the final partial one */
+		do
+		{
+			*dest_addr = *src_addr;
+			dest_addr++;
+			src_addr++;
+			loadedBytes++;
+		} while ( (((uint32_t)dest_addr & (NB_8BIT_IN_FLASHWORD - 1)) != 0) && (loadedBytes < DataSize) );
+	}
+
+	__ISB();
+	__DSB();
+
+	if ( ((startAddress + loadedBytes) & (NB_8BIT_IN_FLASHWORD - 1)) != 0 )
+	{
+		/* final partial word */
+		/* FW forces a write operation even if the write buffer is not full */
+		SET_BIT(*flash_GetBank(startAddress)->CR, FLASH_CR_FW);
+	}
+
+	return loadedBytes;
+}
+/* End flash_LoadFlashWord ---------------------------------------------------*/
+
+
+
+/* flash_IsErasedPattern -----------------------------------------------------*/
+uint8_t flash_IsErasedPattern(uint8_t *src_addr, uint32_t DataSize)
+{
+	for (uint32_t i = 0; i < DataSize; i++)
+	{
+		if (src_addr[i] != 0xFF){return 0;}
+	}
+
+	return 1;
+}
+/* End flash_IsErasedPattern -------------------------------------------------*/
+
+
+
+/* flash_WaitForWriteBuffer --------------------------------------------------*/
+enum FLASH_STATUS flash_WaitForWriteBuffer(const typeDefFlashBank *pBank)
+{
+	uint32_t timeout = 0;
+	uint32_t status = *pBank->SR;
+
+	/* Write buffer is free when the previous flash word is passed to the write queue,
+	 * its programming (QW) is not waited */
+	while ( (status & FLASH_SR_WBNE) && (timeout < TIMEOUT) ){
+		timeout++;
+		status = *pBank->SR;
+	}
+
+	if (timeout >= TIMEOUT){return FLASH_PGM_ERROR;}
+
+	return flash_GetStatus(status);
+}
+/* End flash_WaitForWriteBuffer ----------------------------------------------*/
+
+
+
+/* flash_GetStatus -----------------------------------------------------------*/
+enum FLASH_STATUS flash_GetStatus(uint32_t status)
+{
+	/* converts error flags of FLASH->SR1 or SR2 (the same bits) to FLASH_STATUS */
+	if ( (status & FLASH_FLAG_ALL_ERRORS_BANK1) == 0){return FLASH_RDY;}
+	if (status & FLASH_SR_WRPERR){return FLASH_WRP_ERROR;}
+
+	return FLASH_PGM_ERROR;
+}
+/* End flash_GetStatus -------------------------------------------------------*/
+
+
+
+/* flashSubmitErase ----------------------------------------------------------*/
+enum FLASH_STATUS flashSubmitErase(uint32_t sectorNumb)
+{
+	/* 'sectorNumb' - Sector0..Sector15, bank is taken from the geometry table */
+	const typeDefFlashBank *pBank;
+	flashOpTypeDef *pOp;
+
+	if (sectorNumb >= FLASH_SECTORS_NBR){return FLASH_PGM_ERROR;}
+
+	pBank = &flashBank[sectorNumb / FLASH_SECTORS_BANK];
+	pOp = &flashOp[sectorNumb / FLASH_SECTORS_BANK];
+	sectorNumb -= pBank->firstSector;
+
+	if (pOp->state != FLASH_ST_IDLE){return FLASH_BUSY;}
+	if (flashBankUnlock(pBank) != FLASH_RDY){return FLASH_LOCK_ERROR;}
+
+	*pBank->CCR = FLASH_FLAG_ALL_ERRORS_BANK1 | FLASH_FLAG_EOP_BANK1;	// errors of previous operations
+	*pBank->CR &= (~(FLASH_CR_PSIZE | FLASH_CR_SNB));	// clear
+	*pBank->CR |= (sectorNumb << FLASH_CR_SNB_Pos);		// sector erase selection number
+	*pBank->CR |= FLASH_CR_SER | FLASH_CR_PSIZE_1;
+	*pBank->CR |= FLASH_CR_START; 						// erase start control bit
+
+	pOp->error = FLASH_RDY;
+	pOp->state = FLASH_ST_ERASE;
+
+	return FLASH_RDY;
+}
+/* End flashSubmitErase ------------------------------------------------------*/
+
+
+
+/* flashSubmitWrite ----------------------------------------------------------*/
+enum FLASH_STATUS flashSubmitWrite(uint32_t FlashAddress, uint32_t DataAddress, int DataSize)
+{
+	/* data at 'DataAddress' should not be changed until the end of operation */
+	const typeDefFlashBank *pBank = flash_GetBank(FlashAddress);
+	flashOpTypeDef *pOp = &flashOp[pBank - flashBank];
+
+	if (DataSize <= 0){return FLASH_PGM_ERROR;}
+	if (pOp->state != FLASH_ST_IDLE){return FLASH_BUSY;}
+
+	/* the whole area is in one bank */
+	if (flash_GetBank(FlashAddress + DataSize - 1) != pBank){return FLASH_PGM_ERROR;}
+
+	if (flashBankUnlock(pBank) != FLASH_RDY){return FLASH_LOCK_ERROR;}
+
+	*pBank->CCR = FLASH_FLAG_ALL_ERRORS_BANK1 | FLASH_FLAG_EOP_BANK1;	// errors of previous operations
+	SET_BIT(*pBank->CR, FLASH_CR_PG);
+
+	pOp->dest = (__IO uint8_t *)FlashAddress;
+	pOp->src = (uint8_t *)DataAddress;
+	pOp->remain = DataSize;
+
+	pOp->error = FLASH_RDY;
+	pOp->state = FLASH_ST_WRITE;
+
+	return FLASH_RDY;
+}
+/* End flashSubmitWrite ------------------------------------------------------*/
+
+
+
+/* flashProcess --------------------------------------------------------------*/
+enum FLASH_EVENT flashProcess(uint32_t bank)
+{
+	/* Called from main loop for every bank. Never waits: returns FLASH_EV_NONE while the bank
+	 * is busy, next flash word is loaded as soon as write buffer of the bank is free */
+	const typeDefFlashBank *pBank = &flashBank[bank];
+	flashOpTypeDef *pOp = &flashOp[bank];
+	uint32_t status = *pBank->SR;
+	uint32_t loadedBytes;
+
+	if (pOp->state == FLASH_ST_IDLE){return FLASH_EV_NONE;}
+
+	pOp->error = flash_GetStatus(status);
+
+	if ( (pOp->state == FLASH_ST_WRITE) && (pOp->error == FLASH_RDY) && (pOp->remain > 0) )
+	{
+		/* previous word can still be programmed (QW), it doesn't prevent loading of the next one */
+		if (status & FLASH_SR_WBNE){return FLASH_EV_NONE;}
+
+		loadedBytes = flash_LoadFlashWord(pOp->dest, pOp->src, pOp->remain);
+		pOp->dest += loadedBytes;
+		pOp->src += loadedBytes;
+		pOp->remain -= loadedBytes;
+
+		return FLASH_EV_NONE;
+	}
+
+	if (status & (FLASH_SR_BSY | FLASH_SR_WBNE | FLASH_SR_QW)){return FLASH_EV_NONE;}
+
+	/* operation is completed or failed */
+	CLEAR_BIT(*pBank->CR, (FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB));
+	*pBank->CCR = FLASH_FLAG_ALL_ERRORS_BANK1 | FLASH_FLAG_EOP_BANK1;
+	flashBankLock(pBank);
+
+	pOp->state = FLASH_ST_IDLE;
+
+	return (pOp->error == FLASH_RDY) ? FLASH_EV_DONE : FLASH_EV_ERROR;
+}
+/* End flashProcess ----------------------------------------------------------*/
+
+
+
+/* flashBusy -----------------------------------------------------------------*/
+uint8_t flashBusy(void)
+{
+	/* operation of any bank is in progress */
+	for (uint32_t i = 0; i < FLASH_BANKS; i++)
+	{
+		if (flashBankBusy(i)){return 1;}
+	}
+
+	return 0;
+}
+/* End flashBusy -------------------------------------------------------------*/
+
+
+
+/* flashBankBusy -------------------------------------------------------------*/
+uint8_t flashBankBusy(uint32_t bank)
+{
+	return (flashOp[bank].state != FLASH_ST_IDLE);
+}
+/* End flashBankBusy ---------------------------------------------------------*/
+
+
+
+/* flashGetError -------------------------------------------------------------*/
+enum FLASH_STATUS flashGetError(uint32_t bank)
+{
+	/* result of the last non-blocking operation of the bank */
+	return flashOp[bank].error;
+}
+/* End flashGetError ---------------------------------------------------------*/
+
+
+
+/* flashSwapBanks ------------------------------------------------------------*/
+enum FLASH_STATUS flashSwapBanks(void)
+{
+	/* Toggles option byte SWAP_BANK: after reset the inactive bank is mapped at
+	 * ADDR_FLASH_SECTOR_0_BANK1. Only option bytes are programmed, it takes milliseconds.
+	 * Flash should be idle, bootloader runs from ITCM */
+	uint32_t timeout = 0;
+	enum FLASH_STATUS status = FLASH_RDY;
+
+	if (flashBusy()){return FLASH_BUSY;}
+
+	if (READ_BIT(FLASH->OPTCR, FLASH_OPTCR_OPTLOCK) != 0U)
+	{
+		WRITE_REG(FLASH->OPTKEYR, FLASH_OPT_KEY1);
+		WRITE_REG(FLASH->OPTKEYR, FLASH_OPT_KEY2);
+		if (READ_BIT(FLASH->OPTCR, FLASH_OPTCR_OPTLOCK) != 0U){return FLASH_LOCK_ERROR;}
+	}
+
+	FLASH->OPTCCR = FLASH_OPTCCR_CLR_OPTCHANGEERR;
+	FLASH->OPTSR_PRG ^= FLASH_OPTSR_SWAP_BANK_OPT;
+	FLASH->OPTCR |= FLASH_OPTCR_OPTSTART;
+
+	while ( (FLASH->OPTSR_CUR & FLASH_OPTSR_OPT_BUSY) && (timeout < TIMEOUT) ){timeout++;}
+
+	if ( (timeout >= TIMEOUT) || (FLASH->OPTSR_CUR & FLASH_OPTSR_OPTCHANGEERR) ){status = FLASH_PGM_ERROR;}
+
+	FLASH->OPTCR |= FLASH_OPTCR_OPTLOCK;
+
+	return status;
+}
+/* End flashSwapBanks --------------------------------------------------------*/
+
+
+
+/* flashBanksSwapped ---------------------------------------------------------*/
+uint8_t flashBanksSwapped(void)
+{
+	/* 1 - the running bank is physical BANK2 */
+	return (READ_BIT(FLASH->OPTCR, FLASH_OPTCR_SWAP_BANK) != 0U);
+}
+/* End flashBanksSwapped -----------------------------------------------------*/
+
+
+
+#ifdef FLASH_BENCHMARK
+
+/* flashWriteBytes -----------------------------------------------------------*/
+enum FLASH_STATUS flashWriteBytes( uint32_t FlashAddress, uint32_t DataAddress, int DataSize)
+{
+	enum FLASH_STATUS status;
+
+	/* Previous version of flashWrite: byte by byte copy and wait after every flash word.
+	 * It is kept only to compare with flashWrite in flashBenchmark.
+	 *
+	 * The write operations are executed in the non-volatile memory only by 256-bit data Flash word.
 	 * The application can decide to write as little as 8 bits to a  256 Flash word. In this case, a
 	 * force-write mechanism is used (see FW1/2 bit of FLASH_CR1/2 register)
 	 *
@@ -195,7 +648,7 @@ enum FLASH_STATUS flashWrite( uint32_t FlashAddress, uint32_t DataAddress, int D
 	flashUnlock();
 
   	/* Wait for last operation to be completed */
-  	status = flash_WaitForLastOperation();
+  	status = flash_WaitForLastOperation(&flashBank[0]);
 
   	if(status == FLASH_RDY)
   	{
@@ -230,7 +683,7 @@ enum FLASH_STATUS flashWrite( uint32_t FlashAddress, uint32_t DataAddress, int D
   			}
 
   			/* Wait for last operation to be completed */
-  			status = flash_WaitForLastOperation();
+  			status = flash_WaitForLastOperation(&flashBank[0]);
 
   		} while (writtenBytes < DataSize);
 
@@ -245,7 +698,46 @@ enum FLASH_STATUS flashWrite( uint32_t FlashAddress, uint32_t DataAddress, int D
   return status;
 }
 
-/* End flashWrite ------------------------------------------------------------*/
+/* End flashWriteBytes -------------------------------------------------------*/
+
+
+
+/* flashBenchmark ------------------------------------------------------------*/
+typeDefFlashBench flashBenchmark(uint32_t sectorNumb)
+{
+	/* Sector is erased, then FLASH_BENCH_SIZE bytes are written by each version of flashWrite.
+	 * Result is in CPU cycles (DWT->CYCCNT), 0 - error */
+	static uint64_t benchData[FLASH_BENCH_SIZE / sizeof(uint64_t)];
+	typeDefFlashBench result = {0, 0};
+	uint32_t address = flash_SectorAddress(sectorNumb);
+	uint32_t cycles;
+
+	for (uint32_t i = 0; i < (FLASH_BENCH_SIZE / sizeof(uint64_t)); i++){benchData[i] = 0x0123456789ABCDEFULL + i;}
+
+	/* enable cycle counter */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	if (flash_EraseSector(sectorNumb) != FLASH_RDY){return result;}
+
+	cycles = DWT->CYCCNT;
+	if (flashWriteBytes(address, (uint32_t)benchData, FLASH_BENCH_SIZE) == FLASH_RDY)
+	{
+		result.cyclesBytes = DWT->CYCCNT - cycles;
+	}
+
+	cycles = DWT->CYCCNT;
+	if (flashWrite(address + FLASH_BENCH_SIZE, (uint32_t)benchData, FLASH_BENCH_SIZE) == FLASH_RDY)
+	{
+		result.cyclesWide = DWT->CYCCNT - cycles;
+	}
+
+	return result;
+}
+/* End flashBenchmark --------------------------------------------------------*/
+
+#endif /* FLASH_BENCHMARK */
 
 		
 //end
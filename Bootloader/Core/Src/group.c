@@ -0,0 +1,312 @@
+/**
+  ******************************************************************************
+  * @file           : group.c
+  * @brief          : Group download and msgs 0x57x with sequence number
+  ******************************************************************************
+  *
+  * Group download: one stream on CAN_GROUP_CMD_ID / CAN_GROUP_DATA_ID for several boards.
+  * Boards are selected by the bitmap of start command 0xAB, blocks come in any order,
+  * every board keeps the map of received blocks and answers on CAN_GROUP_STATUS_ID + board id
+  * with its first missing block. Host sends again the blocks which are missing on any board.
+  *
+  * Msgs 0x57x with sequence number (byte0, see 0xBB) are placed in the block by it, so a lost
+  * msg doesn't shift the next ones, missing msgs are reported at 0xCC by selective nack 0xB3.
+  * Parity msgs come after the data msgs of the block, a msg which is the only one missing
+  * in its parity group is restored from them.
+  *
+  * Block buffer and its length are kept by main.c and given to the functions here.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "group.h"
+#include <string.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+/* group download */
+static uint8_t groupMember = 0;			// board is selected for the current group download
+static uint8_t groupMode = 0;			// answers 0x550 are sent as CAN_GROUP_STATUS_ID + board id
+static uint16_t groupBlocks;			// blocks in the image
+static uint32_t rxBlockMap[(PROG_BLOCKS_MAX + 31) / 32];	// received blocks
+
+/* msgs 0x57x with sequence number (byte0), see 0xBB */
+static uint8_t rxSeqMode = 0;
+static uint16_t rxSeqFrames;			// msgs in block
+static uint8_t rxSeqStride;				// program bytes in every msg except the last one
+static uint32_t rxSeqMap[PROG_SEQ_FRAMES_MAX / 32];	// received msgs
+static uint8_t nackSeqBase;				// nack 0xB3: first missing msg
+static uint32_t nackSeqMap;				// nack 0xB3: missing msgs starting from 'nackSeqBase'
+
+/* parity msgs: sequence number 'rxSeqFrames' + n is XOR of msgs n * 'rxParityGroup' .. (n + 1) * 'rxParityGroup' - 1 */
+static uint8_t rxParityGroup;			// msgs per parity msg, 0 - no parity
+static uint8_t rxParity[PROG_BLOCK_SIZE + PROG_MSG_LENGTH_FD];	// program bytes of parity msgs
+static uint32_t rxParityMap[PROG_SEQ_FRAMES_MAX / 32];	// received parity msgs
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* GroupFrameAccepted --------------------------------------------------------*/
+uint8_t GroupFrameAccepted(uint32_t id, uint8_t command)
+{
+	/* group msgs are dropped by boards which are not selected, except group start command */
+	if (groupMember){return 1;}
+	if (id == CAN_GROUP_CMD_ID){return (command == 0xAB);}
+
+	return (id != CAN_GROUP_DATA_ID);
+}
+/* End GroupFrameAccepted ----------------------------------------------------*/
+
+
+
+/* GroupSelect ---------------------------------------------------------------*/
+uint8_t GroupSelect(uint8_t groupCmd, const uint8_t *pCmd, uint32_t length, uint8_t boardId)
+{
+	/* 0xAB on CAN_GROUP_CMD_ID: byte6..7 - bitmap of selected boards, the board takes part
+	 * if its bit is set. Returns 0 if the board is not selected */
+	if ( groupCmd && (length >= 8) && (((pCmd[6] | (pCmd[7] << 8)) & (1U << boardId)) == 0) )
+	{
+		GroupStop();
+		return 0;
+	}
+
+	groupMode = groupCmd;
+	groupMember = groupCmd;
+	return 1;
+}
+/* End GroupSelect -----------------------------------------------------------*/
+
+
+
+/* GroupStop -----------------------------------------------------------------*/
+void GroupStop(void)
+{
+	groupMode = 0;
+	groupMember = 0;
+}
+/* End GroupStop -------------------------------------------------------------*/
+
+
+
+/* GroupStart ----------------------------------------------------------------*/
+void GroupStart(uint32_t imageSize)
+{
+	/* group: only sequential image with size (0 - download is refused), blocks can come in any order */
+	groupBlocks = (imageSize + PROG_BLOCK_SIZE - 1) / PROG_BLOCK_SIZE;
+	memset(rxBlockMap, 0, sizeof(rxBlockMap));
+}
+/* End GroupStart ------------------------------------------------------------*/
+
+
+
+/* GroupActive ---------------------------------------------------------------*/
+uint8_t GroupActive(void)
+{
+	return groupMode;
+}
+/* End GroupActive -----------------------------------------------------------*/
+
+
+
+/* GroupBlocks ---------------------------------------------------------------*/
+uint16_t GroupBlocks(void)
+{
+	return groupBlocks;
+}
+/* End GroupBlocks -----------------------------------------------------------*/
+
+
+
+/* GroupBlockReceived --------------------------------------------------------*/
+uint8_t GroupBlockReceived(uint16_t blockIdx)
+{
+	if (blockIdx >= groupBlocks){return 0;}
+
+	return ((rxBlockMap[blockIdx / 32] & (1UL << (blockIdx % 32))) != 0);
+}
+/* End GroupBlockReceived ----------------------------------------------------*/
+
+
+
+/* GroupMarkBlocks -----------------------------------------------------------*/
+uint16_t GroupMarkBlocks(uint16_t blockIdx, uint16_t count, uint16_t nextBlockIdx)
+{
+	/* blocks are received or skipped, returns the first missing block from 'nextBlockIdx' */
+	for (uint16_t i = blockIdx; (i < (blockIdx + count)) && (i < groupBlocks); i++)
+	{
+		rxBlockMap[i / 32] |= (1UL << (i % 32));
+	}
+
+	while ( (nextBlockIdx < groupBlocks) && GroupBlockReceived(nextBlockIdx) ){nextBlockIdx++;}
+
+	return nextBlockIdx;
+}
+/* End GroupMarkBlocks -------------------------------------------------------*/
+
+
+
+/* GroupSeqStart -------------------------------------------------------------*/
+uint8_t GroupSeqStart(const uint8_t *pCmd, uint32_t length)
+{
+	/* 0xBB: byte3 bit0 - msgs 0x57x carry sequence number, byte4 - msgs in block, byte5 - program bytes per msg,
+	 * byte6 - msgs per parity msg (optional). Returns 0 if msgs can't be placed in the block */
+	uint16_t groups;
+
+	rxSeqMode = (length >= 6) && (pCmd[3] & 0x01);
+	if (!rxSeqMode){return 1;}
+
+	rxSeqFrames = pCmd[4] ? pCmd[4] : PROG_SEQ_FRAMES_MAX;
+	rxSeqStride = pCmd[5];
+	rxParityGroup = (length >= 7) ? pCmd[6] : 0;
+	memset(rxSeqMap, 0, sizeof(rxSeqMap));
+	memset(rxParityMap, 0, sizeof(rxParityMap));
+
+	/* every msg has program bytes of the block, so parity of a block of PROG_BLOCK_SIZE fits 'rxParity' */
+	if ( (rxSeqStride == 0) || (rxSeqStride >= PROG_MSG_LENGTH_FD)
+			|| (((uint32_t)rxSeqFrames - 1) * rxSeqStride >= ProgBlockSize()) ){return 0;}
+
+	/* parity msgs take the sequence numbers after the data msgs, so data msgs and parity msgs together
+	 * fit in 256 (at most 255 data msgs). Parity only for blocks of PROG_BLOCK_SIZE */
+	if (rxParityGroup)
+	{
+		groups = (rxSeqFrames + rxParityGroup - 1) / rxParityGroup;
+		if ( ((rxSeqFrames + groups) > PROG_SEQ_FRAMES_MAX) || (ProgBlockSize() > PROG_BLOCK_SIZE) ){return 0;}
+	}
+
+	return 1;
+}
+/* End GroupSeqStart ---------------------------------------------------------*/
+
+
+
+/* GroupSeqMode --------------------------------------------------------------*/
+uint8_t GroupSeqMode(void)
+{
+	return rxSeqMode;
+}
+/* End GroupSeqMode ----------------------------------------------------------*/
+
+
+
+/* GroupSeqReceive -----------------------------------------------------------*/
+void GroupSeqReceive(uint8_t *pBuff, const uint8_t *pMsg, uint8_t length, uint32_t *pLength)
+{
+	/* byte0 - sequence number, msg is placed by it, so lost msg doesn't shift the next ones.
+	 * '*pLength' - end of received program bytes in 'pBuff' */
+	uint8_t seq = pMsg[0];
+	uint32_t position = (uint32_t)seq * rxSeqStride;
+
+	if ( (length >= 2) && (seq >= rxSeqFrames) && rxParityGroup )
+	{
+		/* parity msg: program bytes are the same length as in data msgs */
+		position = (uint32_t)(seq - rxSeqFrames) * rxSeqStride;
+		if ( ((length - 1) != rxSeqStride) || ((position + rxSeqStride) > sizeof(rxParity)) ){return;}
+
+		memcpy(&rxParity[position], &pMsg[1], rxSeqStride);
+		rxParityMap[(seq - rxSeqFrames) / 32] |= (1UL << ((seq - rxSeqFrames) % 32));
+		return;
+	}
+
+	if ( (length < 2) || (seq >= rxSeqFrames) || ((length - 1) > rxSeqStride)
+			|| ((position + length - 1) > ProgBlockSize()) ){return;}
+
+	memcpy(&pBuff[position], &pMsg[1], length - 1);
+	rxSeqMap[seq / 32] |= (1UL << (seq % 32));
+	if ((position + length - 1) > *pLength){*pLength = position + length - 1;}
+}
+/* End GroupSeqReceive -------------------------------------------------------*/
+
+
+
+/* GroupSeqRecover -----------------------------------------------------------*/
+void GroupSeqRecover(uint8_t *pBuff, uint32_t *pLength)
+{
+	/* Parity msg is XOR of program bytes of its msgs, the last (short) msg is padded with 0xFF.
+	 * If only one msg of the group is missing, it is XOR of parity and the other msgs */
+	uint16_t groups;
+	uint16_t missing;
+	uint16_t lost = 0;
+	uint32_t position;
+	uint8_t value;
+
+	if (rxParityGroup == 0){return;}
+	groups = (rxSeqFrames + rxParityGroup - 1) / rxParityGroup;
+
+	for (uint16_t n = 0; n < groups; n++)
+	{
+		if ( (((uint32_t)n * rxSeqStride + rxSeqStride) > sizeof(rxParity))
+				|| ((rxParityMap[n / 32] & (1UL << (n % 32))) == 0) ){continue;}
+
+		missing = 0;
+		for (uint16_t seq = n * rxParityGroup; (seq < (n + 1) * rxParityGroup) && (seq < rxSeqFrames); seq++)
+		{
+			if ((rxSeqMap[seq / 32] & (1UL << (seq % 32))) == 0)
+			{
+				missing++;
+				lost = seq;
+			}
+		}
+		if (missing != 1){continue;}
+
+		for (uint16_t i = 0; i < rxSeqStride; i++)
+		{
+			value = rxParity[n * rxSeqStride + i];
+			for (uint16_t seq = n * rxParityGroup; (seq < (n + 1) * rxParityGroup) && (seq < rxSeqFrames); seq++)
+			{
+				position = (uint32_t)seq * rxSeqStride + i;
+				if (seq == lost){continue;}
+				value ^= (position < ProgBlockSize()) ? pBuff[position] : 0xFF;
+			}
+
+			position = (uint32_t)lost * rxSeqStride + i;
+			if (position < ProgBlockSize()){pBuff[position] = value;}
+		}
+
+		rxSeqMap[lost / 32] |= (1UL << (lost % 32));
+		position = (uint32_t)lost * rxSeqStride + rxSeqStride;
+		if (position > ProgBlockSize()){position = ProgBlockSize();}
+		if (position > *pLength){*pLength = position;}
+	}
+}
+/* End GroupSeqRecover -------------------------------------------------------*/
+
+
+
+/* GroupSeqMissing -----------------------------------------------------------*/
+uint8_t GroupSeqMissing(void)
+{
+	/* returns 1 if some msgs of the block are missing, then 'nackSeqBase' and 'nackSeqMap'
+	 * are the first missing msg and bitmap of missing msgs starting from it */
+	uint16_t seq;
+
+	for (seq = 0; seq < rxSeqFrames; seq++)
+	{
+		if ((rxSeqMap[seq / 32] & (1UL << (seq % 32))) == 0){break;}
+	}
+	if (seq == rxSeqFrames){return 0;}
+
+	nackSeqBase = (uint8_t)seq;
+	nackSeqMap = 0;
+	for (uint16_t i = 0; (i < 32) && ((seq + i) < rxSeqFrames); i++)
+	{
+		if ((rxSeqMap[(seq + i) / 32] & (1UL << ((seq + i) % 32))) == 0){nackSeqMap |= (1UL << i);}
+	}
+
+	return 1;
+}
+/* End GroupSeqMissing -------------------------------------------------------*/
+
+
+
+/* GroupSeqNack --------------------------------------------------------------*/
+void GroupSeqNack(uint8_t *pBase, uint32_t *pMap)
+{
+	/* selective nack 0xB3 of the last GroupSeqMissing */
+	*pBase = nackSeqBase;
+	*pMap = nackSeqMap;
+}
+/* End GroupSeqNack ----------------------------------------------------------*/
@@ -0,0 +1,377 @@
+/**
+  ******************************************************************************
+  * @file           : isotp.c
+  * @brief          : ISO-TP (ISO 15765-2) transport on CAN1
+  ******************************************************************************
+  *
+  * Host sends msgs on ISOTP_RX_ID + board id, answers go on ISOTP_TX_ID + board id.
+  * A msg (up to ISOTP_MSG_MAX bytes) is collected in 'isotpBuff' and given to main
+  * loop (IsoTpGetMsg), the buffer is busy until IsoTpReleaseMsg.
+  *
+  * Flow control shows the real buffering of the bootloader: BS is the size of the
+  * Rx ring, STmin is 0 because frames are moved from FDCAN to the ring by interrupt.
+  * First frame of the next msg is answered by FC WAIT while the previous msg is not
+  * released (e.g. the block waits for a free staging buffer, i.e. for flash), and by
+  * FC CTS as soon as the buffer is free.
+  *
+  * Single frame which comes while the buffer is busy is kept in 'sfBuff' and given
+  * after the current msg, so msgs are handled in order. Only single frames are sent.
+  * Frames are sent in the format of the last received frame (classic or CAN-FD).
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "isotp.h"
+#include <string.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static FDCAN_TxHeaderTypeDef headerTxMsg_IsoTp;
+
+static enum ISOTP_STATE isotpState = ISOTP_ST_IDLE;
+static uint8_t isotpBuff[ISOTP_MSG_MAX];
+static uint32_t rxSize;					// size of the msg which is received now
+static uint32_t rxCount;				// bytes received
+static uint8_t rxSn;					// expected sequence number of the next consecutive frame
+static uint16_t rxBsCount;				// consecutive frames since the last FC CTS
+static uint32_t rxTimer;				// ms since the last frame of the msg
+
+/* first frame which waits for the buffer (FC WAIT) */
+static uint8_t waitActive = 0;
+static uint32_t waitSize;
+static uint8_t waitData[ISOTP_FRAME_MAX];
+static uint8_t waitLength;
+static uint8_t waitCount;
+static uint32_t waitTimer;
+
+/* single frame which came while the buffer was busy */
+static uint8_t sfBuff[ISOTP_FRAME_MAX];
+static uint8_t sfSize = 0;
+
+/* frames to send, sent when Tx buffer is free */
+static uint8_t fcData[8];
+static uint8_t fcPending = 0;
+static uint8_t txData[ISOTP_FRAME_MAX];
+static uint8_t txLength;
+static uint8_t txPending = 0;
+
+static uint32_t txFDFormat = FDCAN_CLASSIC_CAN;
+static uint32_t txBitRateSwitch = FDCAN_BRS_OFF;
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* IsoTpInit -----------------------------------------------------------------*/
+void IsoTpInit(uint32_t txId)
+{
+	headerTxMsg_IsoTp.Identifier = txId;
+	headerTxMsg_IsoTp.IdType = FDCAN_STANDARD_ID;
+	headerTxMsg_IsoTp.TxFrameType = FDCAN_DATA_FRAME;
+	headerTxMsg_IsoTp.DataLength = FDCAN_DLC_BYTES_8;
+	headerTxMsg_IsoTp.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
+	headerTxMsg_IsoTp.BitRateSwitch = FDCAN_BRS_OFF;
+	headerTxMsg_IsoTp.FDFormat = FDCAN_CLASSIC_CAN;
+	headerTxMsg_IsoTp.TxEventFifoControl = FDCAN_STORE_TX_EVENTS;
+	headerTxMsg_IsoTp.MessageMarker = txId & 0xFF;
+
+	isotpState = ISOTP_ST_IDLE;
+	waitActive = 0;
+	sfSize = 0;
+	fcPending = 0;
+	txPending = 0;
+}
+/* End IsoTpInit -------------------------------------------------------------*/
+
+
+
+/* IsoTpReceiveFrame ---------------------------------------------------------*/
+void IsoTpReceiveFrame(typeDefCanRxFrame *pFrame)
+{
+	/* called from main loop for every frame on ISOTP_RX_ID */
+	uint8_t *data = pFrame->data;
+	uint8_t length = pFrame->length;
+	uint32_t size;
+	uint8_t offset;
+
+	if (length == 0){return;}
+
+	txFDFormat = pFrame->header.FDFormat;
+	txBitRateSwitch = pFrame->header.BitRateSwitch;
+
+	switch (data[0] & 0xF0)
+	{
+		case ISOTP_PCI_SF:
+			/* SF_DL in low nibble, or 0 and SF_DL in byte1 (CAN-FD) */
+			size = data[0] & 0x0F;
+			offset = 1;
+			if (size == 0)
+			{
+				if (length < 2){return;}
+				size = data[1];
+				offset = 2;
+			}
+			if ( (size == 0) || ((size + offset) > length) ){return;}
+
+			if (isotpState == ISOTP_ST_IDLE)
+			{
+				memcpy(isotpBuff, &data[offset], size);
+				rxSize = size;
+				isotpState = ISOTP_ST_READY;
+			}
+			else if ( (sfSize == 0) && !waitActive )
+			{
+				memcpy(sfBuff, &data[offset], size);
+				sfSize = size;
+			}
+			break;
+
+		case ISOTP_PCI_FF:
+			/* FF_DL in 12 bits, or 0 and FF_DL in byte2..5 */
+			size = ((data[0] & 0x0F) << 8) | data[1];
+			offset = 2;
+			if (size == 0)
+			{
+				if (length < 6){return;}
+				size = ((uint32_t)data[2] << 24) | (data[3] << 16) | (data[4] << 8) | data[5];
+				offset = 6;
+			}
+			if (length < offset){return;}
+
+			if (size > ISOTP_MSG_MAX)
+			{
+				IsoTpSendFlowControl(ISOTP_FC_OVFLW);
+				return;
+			}
+
+			if (isotpState == ISOTP_ST_READY)
+			{
+				/* previous msg is not handled yet, host waits */
+				waitActive = 1;
+				waitSize = size;
+				waitLength = length - offset;
+				memcpy(waitData, &data[offset], waitLength);
+				waitCount = 0;
+				waitTimer = 0;
+				IsoTpSendFlowControl(ISOTP_FC_WAIT);
+				return;
+			}
+
+			/* a new FF stops the msg which is received now */
+			IsoTpStartRx(size, &data[offset], length - offset);
+			break;
+
+		case ISOTP_PCI_CF:
+			if (isotpState != ISOTP_ST_RX){return;}
+
+			if ((data[0] & 0x0F) != rxSn)
+			{
+				isotpState = ISOTP_ST_IDLE;		// lost frame, host gets timeout
+				return;
+			}
+			rxSn = (rxSn + 1) & 0x0F;
+			rxTimer = 0;
+
+			size = length - 1;
+			if (size > (rxSize - rxCount)){size = rxSize - rxCount;}
+			memcpy(&isotpBuff[rxCount], &data[1], size);
+			rxCount += size;
+
+			if (rxCount >= rxSize)
+			{
+				isotpState = ISOTP_ST_READY;
+			}
+			else if (++rxBsCount >= ISOTP_BLOCK_SIZE)
+			{
+				/* this frame was taken from the ring, so the whole ring is free for the next BS frames */
+				rxBsCount = 0;
+				IsoTpSendFlowControl(ISOTP_FC_CTS);
+			}
+			break;
+
+		case ISOTP_PCI_FC:
+		default:
+			/* only single frames are sent, so FC from host is not expected */
+			break;
+	}
+}
+/* End IsoTpReceiveFrame -----------------------------------------------------*/
+
+
+
+/* IsoTpStartRx --------------------------------------------------------------*/
+void IsoTpStartRx(uint32_t size, uint8_t *pData, uint8_t length)
+{
+	/* first frame: 'length' bytes of data are in it */
+	if (length > size){length = size;}
+
+	memcpy(isotpBuff, pData, length);
+	rxSize = size;
+	rxCount = length;
+	rxSn = 1;
+	rxBsCount = 0;
+	rxTimer = 0;
+	isotpState = ISOTP_ST_RX;
+
+	IsoTpSendFlowControl(ISOTP_FC_CTS);
+}
+/* End IsoTpStartRx ----------------------------------------------------------*/
+
+
+
+/* IsoTpProcess --------------------------------------------------------------*/
+void IsoTpProcess(void)
+{
+	/* main loop: frames are sent when there is room in Tx FIFO, FC first */
+	if (fcPending)
+	{
+		if (IsoTpSendFrame(fcData, 3) == CAN_STATUS_OK){fcPending = 0;}
+	}
+	else if (txPending)
+	{
+		if (IsoTpSendFrame(txData, txLength) == CAN_STATUS_OK){txPending = 0;}
+	}
+}
+/* End IsoTpProcess ----------------------------------------------------------*/
+
+
+
+/* IsoTpTick1ms --------------------------------------------------------------*/
+void IsoTpTick1ms(void)
+{
+	if (isotpState == ISOTP_ST_RX)
+	{
+		if (++rxTimer >= ISOTP_TIMEOUT_CR){isotpState = ISOTP_ST_IDLE;}
+	}
+
+	if ( waitActive && (++waitTimer >= ISOTP_WAIT_PERIOD) )
+	{
+		waitTimer = 0;
+		if (++waitCount >= ISOTP_WAIT_MAX)
+		{
+			waitActive = 0;
+			IsoTpSendFlowControl(ISOTP_FC_OVFLW);
+		}
+		else
+		{
+			IsoTpSendFlowControl(ISOTP_FC_WAIT);
+		}
+	}
+}
+/* End IsoTpTick1ms ----------------------------------------------------------*/
+
+
+
+/* IsoTpGetMsg ---------------------------------------------------------------*/
+uint8_t *IsoTpGetMsg(uint32_t *pSize)
+{
+	/* received msg or 0, the same msg is returned until IsoTpReleaseMsg */
+	if (isotpState != ISOTP_ST_READY){return 0;}
+
+	*pSize = rxSize;
+	return isotpBuff;
+}
+/* End IsoTpGetMsg -----------------------------------------------------------*/
+
+
+
+/* IsoTpReleaseMsg -----------------------------------------------------------*/
+void IsoTpReleaseMsg(void)
+{
+	if (isotpState != ISOTP_ST_READY){return;}
+
+	isotpState = ISOTP_ST_IDLE;
+
+	/* msgs are given in order of reception: single frame which came meanwhile, then FF which waits */
+	if (sfSize != 0)
+	{
+		memcpy(isotpBuff, sfBuff, sfSize);
+		rxSize = sfSize;
+		sfSize = 0;
+		isotpState = ISOTP_ST_READY;
+	}
+	else if (waitActive)
+	{
+		waitActive = 0;
+		IsoTpStartRx(waitSize, waitData, waitLength);
+	}
+}
+/* End IsoTpReleaseMsg -------------------------------------------------------*/
+
+
+
+/* IsoTpSend -----------------------------------------------------------------*/
+uint8_t IsoTpSend(uint8_t *pData, uint8_t size)
+{
+	/* single frame, returns 0 if it is too long or the previous one is not sent yet */
+	uint8_t maxSize = (txFDFormat == FDCAN_FD_CAN) ? (ISOTP_FRAME_MAX - 2) : 7;
+
+	if ( (size == 0) || (size > maxSize) || txPending ){return 0;}
+
+	if (size <= 7)
+	{
+		txData[0] = ISOTP_PCI_SF | size;
+		memcpy(&txData[1], pData, size);
+		txLength = size + 1;
+	}
+	else
+	{
+		txData[0] = ISOTP_PCI_SF;
+		txData[1] = size;
+		memcpy(&txData[2], pData, size);
+		txLength = size + 2;
+	}
+	txPending = 1;
+
+	IsoTpProcess();
+	return 1;
+}
+/* End IsoTpSend -------------------------------------------------------------*/
+
+
+
+/* IsoTpTxBusy ---------------------------------------------------------------*/
+uint8_t IsoTpTxBusy(void)
+{
+	/* frame is not on the bus until its Tx event comes */
+	return fcPending || txPending || (CAN1_TxPending() != 0);
+}
+/* End IsoTpTxBusy -----------------------------------------------------------*/
+
+
+
+/* IsoTpSendFlowControl ------------------------------------------------------*/
+void IsoTpSendFlowControl(uint8_t flowStatus)
+{
+	fcData[0] = ISOTP_PCI_FC | flowStatus;
+	fcData[1] = ISOTP_BLOCK_SIZE;
+	fcData[2] = ISOTP_ST_MIN;
+	fcPending = 1;
+
+	IsoTpProcess();
+}
+/* End IsoTpSendFlowControl --------------------------------------------------*/
+
+
+
+/* IsoTpSendFrame ------------------------------------------------------------*/
+uint16_t IsoTpSendFrame(uint8_t *pData, uint8_t length)
+{
+	/* frame is padded to 8 bytes or to the next CAN-FD data length */
+	static uint8_t frame[ISOTP_FRAME_MAX];
+	uint32_t dlc = 8;
+
+	while ( (DLCtoBytes[dlc] < length) && (dlc < 15) ){dlc++;}
+
+	memset(frame, ISOTP_PADDING, sizeof(frame));
+	memcpy(frame, pData, length);
+
+	headerTxMsg_IsoTp.FDFormat = txFDFormat;
+	headerTxMsg_IsoTp.BitRateSwitch = txBitRateSwitch;
+	headerTxMsg_IsoTp.DataLength = dlc << 16;
+	return FDCAN_SendFifo(&headerTxMsg_IsoTp, frame, CAN_MODULE1);
+}
+/* End IsoTpSendFrame --------------------------------------------------------*/
@@ -0,0 +1,148 @@
+/**
+  ******************************************************************************
+  * @file           : journal.c
+  * @brief          : Download progress journal in backup SRAM
+  ******************************************************************************
+  *
+  * Journal keeps image identity and the end of the area which is already
+  * programmed, so after reset or a lost host the download can go on from there
+  * (commands 0xE4 and 0xAC, see README). It is a ring of records in backup SRAM,
+  * every change is appended as a new record with the next sequence number and
+  * CRC32 written at the end. A record which is broken by reset while it is
+  * written fails CRC, and the previous one is used.
+  *
+  * Backup SRAM is kept over reset and, with backup regulator on, while VBAT is
+  * supplied. Without a battery on VBAT (NUCLEO: VBAT is connected to VDD) the
+  * journal is lost at power off and the next download starts from the beginning.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "journal.h"
+#include "crc.h"
+#include <stddef.h>
+#include <string.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static journalRecordTypeDef * const journal = (journalRecordTypeDef *)JOURNAL_ADDRESS;
+static journalRecordTypeDef *journalLast = 0;	// the newest valid record, 0 - journal is empty
+static uint32_t journalNext = 0;				// index of the record to write
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* JournalInit ---------------------------------------------------------------*/
+void JournalInit(void)
+{
+	/* CRC unit should be initialized before */
+	uint32_t timeout = 0xFFFF;
+
+	RCC->AHB4ENR |= RCC_AHB4ENR_BKPRAMEN;
+	PWR->CR1 |= PWR_CR1_DBP;				// write access to backup domain
+	PWR->CR2 |= PWR_CR2_BREN;				// backup SRAM is kept on VBAT
+	while ( ((PWR->CR2 & PWR_CR2_BRRDY) == 0) && (timeout > 0) ){timeout--;}
+
+	journalLast = 0;
+	journalNext = 0;
+
+	for (uint32_t i = 0; i < JOURNAL_RECORDS; i++)
+	{
+		if ( (journal[i].magic != JOURNAL_MAGIC)
+				|| (journal[i].crc != CrcCalc32((uint32_t)&journal[i], offsetof(journalRecordTypeDef, crc))) ){continue;}
+
+		if ( (journalLast == 0) || (journal[i].seq > journalLast->seq) )
+		{
+			journalLast = &journal[i];
+			journalNext = (i + 1) % JOURNAL_RECORDS;
+		}
+	}
+}
+/* End JournalInit -----------------------------------------------------------*/
+
+
+
+/* JournalStart --------------------------------------------------------------*/
+void JournalStart(uint32_t imageSize)
+{
+	/* new download: flash is rewritten, so the old record is not valid any more */
+	journalRecordTypeDef record;
+
+	memset(&record, 0, sizeof(record));
+	memset(record.head, 0xFF, sizeof(record.head));
+	record.imageSize = imageSize;
+
+	JournalAppend(&record);
+}
+/* End JournalStart ----------------------------------------------------------*/
+
+
+
+/* JournalSetId --------------------------------------------------------------*/
+void JournalSetId(uint32_t imageId)
+{
+	journalRecordTypeDef record;
+
+	if (journalLast == 0){return;}
+
+	memcpy(&record, journalLast, sizeof(record));
+	record.imageId = imageId;
+
+	JournalAppend(&record);
+}
+/* End JournalSetId ----------------------------------------------------------*/
+
+
+
+/* JournalCommit -------------------------------------------------------------*/
+void JournalCommit(uint32_t committed, uint8_t *pHead)
+{
+	/* 'committed' - area which is in flash, 'pHead' - first flash word if it is not programmed yet */
+	journalRecordTypeDef record;
+
+	if ( (journalLast == 0) || (journalLast->committed == committed) ){return;}
+
+	memcpy(&record, journalLast, sizeof(record));
+	record.committed = committed;
+	if (pHead != 0){memcpy(record.head, pHead, sizeof(record.head));}
+	else {memset(record.head, 0xFF, sizeof(record.head));}
+
+	JournalAppend(&record);
+}
+/* End JournalCommit ---------------------------------------------------------*/
+
+
+
+/* JournalGet ----------------------------------------------------------------*/
+journalRecordTypeDef *JournalGet(void)
+{
+	return journalLast;
+}
+/* End JournalGet ------------------------------------------------------------*/
+
+
+
+/* JournalAppend -------------------------------------------------------------*/
+void JournalAppend(journalRecordTypeDef *pRecord)
+{
+	/* record is written to the next slot, CRC last, so the previous record is valid until it is done */
+	journalRecordTypeDef *pSlot = &journal[journalNext];
+
+	pRecord->magic = JOURNAL_MAGIC;
+	pRecord->seq = (journalLast != 0) ? (journalLast->seq + 1) : 0;
+
+	pSlot->crc = 0;
+	__DSB();
+	memcpy(pSlot, pRecord, offsetof(journalRecordTypeDef, crc));
+	__DSB();
+	pSlot->crc = CrcCalc32((uint32_t)pSlot, offsetof(journalRecordTypeDef, crc));
+	__DSB();
+
+	journalLast = pSlot;
+	journalNext = (journalNext + 1) % JOURNAL_RECORDS;
+}
+/* End JournalAppend ---------------------------------------------------------*/
@@ -10,7 +10,7 @@
   * Sector1 (0x8020000) is used for configuration data (not default board-id, etc.) This sector
   * is erasing and writing by user program.
   * User program can be written from the beginning of Sector2 (0x8040000) to the end
-  * of BANK1 (Sector7). This bootloader doesn't have functions to work with BANK2.
+  * of BANK2 (Sector15), or to BANK2 only as the inactive slot of A/B update (0xAD).
   * After reset bootloader waits some delay for CAN-msg with defined id. If there is no can-msg
   * then user program starts.
   *
@@ -19,34 +19,81 @@
   *
   * Bootloader can be reset by CAN-msg with id: 0x560+BoardId. Byte0 should be 0x55, Byte1= 0x66
   *
+  * Besides the 'CANLoader' protocol (start 0xAA) there is a windowed mode (start 0xAB): every
+  * block is tagged with its index, host can send several blocks without waiting for an answer
+  * and bootloader acknowledges them cumulatively with msg 0x550 (see README.md).
+  *
+  * Received blocks are staged in several buffers (prog.c) and written to flash from main loop,
+  * so in windowed mode the next block is received while the previous one is programmed.
+  *
   ******************************************************************************
   */
 
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
+#include <string.h>
 
 /* Private constants ---------------------------------------------------------*/
 const uint16_t VERSION = 1.3;
 
 /* Defines -------------------------------------------------------------------*/
 #define BOOT_START_ADDRESS 					(0x8000000U)
-#define APP_PROG_ADDRESS 					(0x8040000U)
+#define VECTOR_TABLE_WORDS					(16U + 150U)	// Cortex-M7 exceptions and STM32H743 interrupts
 #define APP_KONF_ADDRESS 					(0x8020000U)
 
 #define FLASH_DATA_HEADER 					((uint32_t)0x0123fedc)
 
 #define DELAY_BEFORE_JUMP_TO_USER_PROGRAM 	(2000U) // ms
-#define PROG_MSG_LENGTH						(8U)
 
 /* Variables -----------------------------------------------------------------*/
 
 volatile uint8_t checksum = 0;
 
-static uint8_t buff[1024];
-static uint16_t i_buff = 0;
+static uint8_t *rxBuff;					// staging buffer of the block which is received now
+static uint32_t i_buff = 0;
 
 static uint16_t Status = 0;
 
+/* download state */
+static uint16_t nextBlockIdx;			// all blocks before this index are received and queued for flash
+static uint16_t rxBlockIdx;				// index of the block which is received now
+static uint8_t rxBlockAccept = 0;		// 0 - frames of current block are dropped
+
+/* windowed mode */
+static uint8_t windowMode = 0;
+static uint8_t blockCrcMode = 0;		// 0xCC carries CRC32 of the block instead of checksum, see 0xAB
+
+/* compressed mode (windowed only): blocks carry heatshrink stream, see unpack.c */
+static uint8_t packMode = 0;
+static uint8_t endPending = 0;			// 0xCD is answered when the whole image is written
+
+/* patch mode (windowed only): host sends only changed blocks, see prog.c */
+static uint8_t patchMode = 0;
+
+/* group download: one stream for many boards, blocks in any order, see 0xAB and group.c */
+static uint8_t boardId = 0;				// config data of the board, 0 if there is no config
+static uint8_t rxGroupCmd;				// command which is handled now came on CAN_GROUP_CMD_ID
+static uint16_t ackBlockIdx;			// block of the last answer 0xB0/0xB1
+
+/* progress journal: sequential download with image size, see journal.c */
+static uint8_t journalActive = 0;
+
+/* A/B slots: 0xAB with slot flag writes BANK2, 0xAD swaps banks when its answer is sent */
+static uint8_t swapPending = 0;
+
+/* block CRC query (0xE3) */
+static uint16_t hashNextBlock;
+static uint16_t hashEndBlock;
+static uint32_t hashBlockSize;			// block size granted by the last 0xAB or RequestDownload (ProgBlockSize)
+
+/* download statistics (0xE2) */
+static uint32_t downloadRxBytes;		// program bytes received in accepted blocks
+static uint32_t downloadTime;			// ms since start command until the end of stream
+static uint8_t downloadActive = 0;
+
+/* vector table in RAM: vectors are not fetched from BANK1 while it is erased or programmed */
+static uint32_t vectorTable[VECTOR_TABLE_WORDS] __ALIGNED(1024);
+
 static uint32_t delayBeforeJump = DELAY_BEFORE_JUMP_TO_USER_PROGRAM;
 static uint8_t enableJump = 1;
 
@@ -64,14 +111,13 @@ static typeDefCanMessage CAN_TxMsg_0x555;
 
 
 /* ---------- CAN RxMsg headers ------------------*/
-uint32_t rxCANid[] = {0x560, 0x570};
-
-extern FDCAN_FilterTypeDef headerRxMsg_0x56x; //declaration in 'can.c'
-extern FDCAN_FilterTypeDef headerRxMsg_0x57x; //declaration in 'can.c'
+uint32_t rxCANid[] = {0x560, 0x570, CAN_GROUP_CMD_ID, CAN_GROUP_DATA_ID, ISOTP_RX_ID};
 
 static typeDefCanMessage CAN_RxMsg_0x56x;
 static typeDefCanMessage CAN_RxMsg_0x57x;
 
+static typeDefCanRxFrame rxFrame;
+
 /*----------------------------------------------------------------------------*/
 
 
@@ -85,14 +131,15 @@ int main(void)
 
 	/* After reset MC reads flash from the beginning (0x08000000). At this address this Bootloader is written. After execution
 	 * the boot loader jump to User program, which makes a new assignation of 'Vector Table Offset Register'.
-	 * When we jump to Bootloader from the User prog then reassignation of 'Vector Table Offset Register' is required
+	 * When we jump to Bootloader from the User prog then reassignation of 'Vector Table Offset Register' is required.
+	 * Vector table is copied to RAM, handlers are in ITCMRAM (see .itcm in linker script), so interrupts are
+	 * serviced while BANK1 is erased or programmed
 	 * */
-	if (SCB->VTOR != BOOT_START_ADDRESS)
-	{
-		__disable_irq();
-		SCB->VTOR = (uint32_t)BOOT_START_ADDRESS;
-		__enable_irq();
-	}
+	__disable_irq();
+	memcpy(vectorTable, (uint32_t *)BOOT_START_ADDRESS, sizeof(vectorTable));
+	SCB->VTOR = (uint32_t)vectorTable;
+	__DSB();
+	__enable_irq();
 
 	/* FLASH_SetLatency */
 	MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, FLASH_ACR_LATENCY_4WS);
@@ -122,6 +169,12 @@ int main(void)
 
 	InitCAN1(rxCANid);
 
+	CrcInit();
+
+	JournalInit();
+
+	IsoTpInit(ISOTP_TX_ID + boardId);
+
 	CheckAppExist();
 
 	TimerStart();
@@ -130,7 +183,11 @@ int main(void)
 	while(1)
 	{
 		CheckRxMessageCAN1();
+		CheckIsoTpMessage();
 		CheckTxMessageCAN1();
+		CheckStagedBlocks();
+		CheckHashQuery();
+		CheckSlotSwap();
 
 		/* actions for 1 ms period */
 		if (TimerGet().FLAGS.flag_1ms)
@@ -179,7 +236,8 @@ void ReadAppConfigFromFlash(void)
 		{
 			rxCANid[0] = (uint32_t) 0x560 + config_data;
 			rxCANid[1] = (uint32_t) 0x570 + config_data;
-			rxCANid[2] = (uint32_t) 0x580 + config_data;
+			rxCANid[4] = (uint32_t) ISOTP_RX_ID + config_data;
+			boardId = (uint8_t)config_data;
 		}
 
 		address += 4;
@@ -237,6 +295,10 @@ void Tick_1ms (void)
 		if (delayBeforeJump > 0) delayBeforeJump--;
 	}
 
+	if (downloadActive){downloadTime++;}
+
+	IsoTpTick1ms();
+
 	if (delayBeforeJump == 0)
 	{
 
@@ -246,7 +308,9 @@ void Tick_1ms (void)
 		appJumpAdress = *((volatile uint32_t*)(APP_PROG_ADDRESS + 4));
 		GoToApp = (void (*)(void))appJumpAdress; // new address for function
 		__disable_irq();
+		DeInitCAN1();                                //disable FDCAN1 interrupt
 		SysTick->CTRL = 0x00000000;                  //disable SysTick
+		SCB->VTOR = (uint32_t)BOOT_START_ADDRESS;    //vector table in RAM can be overwritten by user program
 		__set_MSP(*((volatile uint32_t*)APP_PROG_ADDRESS)); // move stack pointer on new address
 		__NOP();
 		__NOP();
@@ -291,28 +355,89 @@ void InitLEDs(void)
 /* CheckTxMessageCAN1 --------------------------------------------------------*/
 void CheckTxMessageCAN1 (void)
 {
+	/* msgs go to Tx FIFO, if it is full a msg stays pending and is sent on the next call */
+	CAN1_TxEventPoll();
+
 	if (CAN_TxMsg_0x550.onetime_transmit)
 	{
-		CAN_TxMsg_0x550.onetime_transmit = 0;
-
 		CAN_TxMsg_0x550.data[0] = Status;
+		if (Status == 0xB3)
+		{
+			/* selective nack: byte1..2 - block index, byte3 - first missing msg, byte4..7 - bitmap of missing msgs */
+			uint32_t nackSeqMap;
+			CAN_TxMsg_0x550.data[1] = (uint8_t)rxBlockIdx;
+			CAN_TxMsg_0x550.data[2] = (uint8_t)(rxBlockIdx >> 8);
+			GroupSeqNack(&CAN_TxMsg_0x550.data[3], &nackSeqMap);
+			memcpy(&CAN_TxMsg_0x550.data[4], &nackSeqMap, sizeof(nackSeqMap));
+			headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_8;
+		}
+		else if (Status == 0xAD)
+		{
+			/* slot activation: byte1 - 1 if the running bank is physical BANK2 (before the swap) */
+			CAN_TxMsg_0x550.data[1] = flashBanksSwapped();
+			headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_2;
+		}
+		else if (windowMode)
+		{
+			/* cumulative ack: byte1..2 - index of the next expected block, byte3 - free staging buffers */
+			CAN_TxMsg_0x550.data[1] = (uint8_t)nextBlockIdx;
+			CAN_TxMsg_0x550.data[2] = (uint8_t)(nextBlockIdx >> 8);
+			CAN_TxMsg_0x550.data[3] = packMode ? UnpackFreeBuffers() : ProgFreeBuffers();
+			headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_4;
+
+			/* group: byte1..2 - the first missing block, byte4..5 - block of this answer */
+			if (GroupActive())
+			{
+				CAN_TxMsg_0x550.data[4] = (uint8_t)ackBlockIdx;
+				CAN_TxMsg_0x550.data[5] = (uint8_t)(ackBlockIdx >> 8);
+				headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_6;
+			}
+			else if (Status == 0xAB)
+			{
+				/* start: byte4 - block size PROG_BLOCK_SIZE << byte4 which is granted */
+				CAN_TxMsg_0x550.data[4] = (uint8_t)(31U - __CLZ(ProgBlockSize() / PROG_BLOCK_SIZE));
+				headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_5;
+			}
+		}
+		else if (Status == 0xB1)
+		{
+			/* nack: byte1..2 - index of the block to send again */
+			CAN_TxMsg_0x550.data[1] = (uint8_t)nextBlockIdx;
+			CAN_TxMsg_0x550.data[2] = (uint8_t)(nextBlockIdx >> 8);
+			CAN_TxMsg_0x550.data[3] = 0;
+			headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_4;
+		}
+		else
+		{
+			headerTxMsg_0x550.DataLength = FDCAN_DLC_BYTES_2;
+			CAN_TxMsg_0x550.data[1] = 0;
+		}
 
-		FDCAN_SendMessage(&headerTxMsg_0x550, CAN_TxMsg_0x550.data, TxMsg_0x550_BUF_NUMBER, CAN_MODULE1);
-		Status = 0;
+		/* boards of a group answer at the same time, so every board has its own id */
+		headerTxMsg_0x550.Identifier = GroupActive() ? (CAN_GROUP_STATUS_ID + boardId) : 0x550;
+		if (FDCAN_SendFifo(&headerTxMsg_0x550, CAN_TxMsg_0x550.data, CAN_MODULE1) == CAN_STATUS_OK)
+		{
+			CAN_TxMsg_0x550.onetime_transmit = 0;
+			Status = 0;
+		}
 	}
 
 
 	if (CAN_TxMsg_0x551.onetime_transmit)
 	{
-		FDCAN_SendMessage(&headerTxMsg_0x551, CAN_TxMsg_0x551.data, TxMsg_0x551_BUF_NUMBER, CAN_MODULE1);
-		CAN_TxMsg_0x551.onetime_transmit = 0;
+		if (FDCAN_SendFifo(&headerTxMsg_0x551, CAN_TxMsg_0x551.data, CAN_MODULE1) == CAN_STATUS_OK)
+		{
+			CAN_TxMsg_0x551.onetime_transmit = 0;
+		}
 	}
 
 
 	if (CAN_TxMsg_0x555.onetime_transmit)
 	{
-		FDCAN_SendMessage(&headerTxMsg_0x555, CAN_TxMsg_0x555.data, TxMsg_0x555_BUF_NUMBER, CAN_MODULE1);
-		CAN_TxMsg_0x555.onetime_transmit = 0;
+		if (FDCAN_SendFifo(&headerTxMsg_0x555, CAN_TxMsg_0x555.data, CAN_MODULE1) == CAN_STATUS_OK)
+		{
+			CAN_TxMsg_0x555.onetime_transmit = 0;
+		}
 	}
 
 
@@ -324,20 +449,41 @@ void CheckTxMessageCAN1 (void)
 /* CheckRxMessageCAN1 -------------------------------------------------------*/
 void CheckRxMessageCAN1 (void)
 {
-	 uint32_t reg_NewDataFlags = FDCAN1->NDAT1; // for RxBufferIndex < 32
+	/* Msgs are moved from FDCAN1 Rx FIFO to the ring by interrupt, so nothing is lost
+	 * while main loop waits for flash. One msg per call, answer is sent before the next one */
+	if (CAN1_RxRingPop(&rxFrame) == 0)
+	{
+		CAN1_RxPoll();
+		if (CAN1_RxRingPop(&rxFrame) == 0){return;}
+	}
+
+	/* ISO-TP frames, msgs are handled by CheckIsoTpMessage */
+	if (rxFrame.header.Identifier == rxCANid[4])
+	{
+		enableJump = 0;
+		IsoTpReceiveFrame(&rxFrame);
+		return;
+	}
+
+	/* group msgs are dropped by boards which are not selected, except group start command */
+	rxGroupCmd = (rxFrame.header.Identifier == rxCANid[2]);
+	if (!GroupFrameAccepted(rxFrame.header.Identifier, rxFrame.data[0])){return;}
 
 	/* Check Msg 0x56x reception */
-	if((reg_NewDataFlags & (1 << headerRxMsg_0x56x.RxBufferIndex)) != 0)
+	if ( (rxFrame.header.Identifier == rxCANid[0]) || rxGroupCmd )
 	{
-		ReceiveCanMsg(headerRxMsg_0x56x.RxBufferIndex, CAN_RxMsg_0x56x.data, CAN_MODULE1);
+		memcpy(CAN_RxMsg_0x56x.data, rxFrame.data, rxFrame.length);
+		CAN_RxMsg_0x56x.length = rxFrame.length;
+		Config_TxFrameFormat(rxFrame.header.FDFormat, rxFrame.header.BitRateSwitch);	// answer in the format of the command
 		Actions_CAN_0x56x_received();
 	}
 
 
 	/* Check Msg 0x57x reception */
-	if((reg_NewDataFlags & (1 << headerRxMsg_0x57x.RxBufferIndex)) != 0)
+	else if ( (rxFrame.header.Identifier == rxCANid[1]) || (rxFrame.header.Identifier == rxCANid[3]) )
 	{
-		ReceiveCanMsg(headerRxMsg_0x57x.RxBufferIndex, CAN_RxMsg_0x57x.data, CAN_MODULE1);
+		memcpy(CAN_RxMsg_0x57x.data, rxFrame.data, rxFrame.length);
+		CAN_RxMsg_0x57x.length = rxFrame.length;
 		Actions_CAN_0x57x_received();
 	}
 
@@ -350,78 +496,258 @@ void CheckRxMessageCAN1 (void)
 /* Actions_CAN_0x56x_received ------------------------------------------------*/
 void Actions_CAN_0x56x_received(void)
 {
-	static uint32_t offset;
-	static uint16_t flashNotErase;
-	static uint8_t sectorNbr;
-	static uint32_t sectorEndAddress;
+	uint16_t blockIdx;
 	enableJump = 0;
 
 	switch(CAN_RxMsg_0x56x.data[0])
 	{
 		case 0xAA:
-			offset = 0;
-			flashNotErase = 0;
-
-			sectorNbr = FLASH_SECTOR_USER_PROG;
-			sectorEndAddress = ADDR_FLASH_SECTOR_2_BANK1 - 1;
+			windowMode = 0;
+			nextBlockIdx = 0;
+			GroupStop();
 
-			Status = 0xAA;
+			Status = (StartDownload() == PROG_ERROR) ? 0 : 0xAA;
 			CAN_TxMsg_0x550.onetime_transmit = 1;
 			break;
 
+		case 0xAB: // start of windowed download, on CAN_GROUP_CMD_ID - group download (byte6..7 - selected boards)
+			if (!GroupSelect(rxGroupCmd, CAN_RxMsg_0x56x.data, CAN_RxMsg_0x56x.length, boardId)){break;}
+
+			windowMode = 1;
+			nextBlockIdx = 0;
+
+			SendWindowAck((StartDownload() == PROG_ERROR) ? 0 : 0xAB);
+			break;
+
+		case 0xAC: // resume windowed download after reset: byte1..4 - image id
+			windowMode = 1;
+			nextBlockIdx = 0;
+			GroupStop();
+
+			SendWindowAck((ResumeDownload() == PROG_ERROR) ? 0 : 0xAC);
+			break;
+
 		case 0xBB:
-			CAN_TxMsg_0x555.onetime_transmit = 1;
 			checksum = 0;
 			i_buff = 0;
+
+			/* block is dropped if all staging buffers wait for flash programming */
+			rxBuff = packMode ? UnpackGetRxBuffer() : ProgGetRxBuffer();
+			if (rxBuff != 0){memset(rxBuff, 0xFF, ProgBlockSize());}
+
+			/* byte3..6 - msgs 0x57x with sequence number and parity msgs, see group.c */
+			if (!GroupSeqStart(CAN_RxMsg_0x56x.data, CAN_RxMsg_0x56x.length)){rxBuff = 0;}
+
+			if (windowMode)
+			{
+				rxBlockIdx = CAN_RxMsg_0x56x.data[1] | (CAN_RxMsg_0x56x.data[2] << 8);
+				rxBlockAccept = BlockAcceptable(rxBlockIdx) && (rxBuff != 0);
+			}
+			else
+			{
+				rxBlockIdx = nextBlockIdx;
+				rxBlockAccept = (rxBuff != 0);
+				CAN_TxMsg_0x555.onetime_transmit = 1;
+			}
 			break;
 
 		case 0xCC:
-			if (flashNotErase){break;}
+			if (ProgFailed()){break;}
 			uint8_t checksum_can = CAN_RxMsg_0x56x.data[1];
-			if ((uint8_t)(checksum + checksum_can) == 0)
+			blockIdx = windowMode ? (CAN_RxMsg_0x56x.data[2] | (CAN_RxMsg_0x56x.data[3] << 8)) : rxBlockIdx;
+
+			if (GroupSeqMode() && rxBlockAccept && (blockIdx == rxBlockIdx))
 			{
-				// if WriteData occupies next sector in Flash memory then clear this sector before writing
-				if ( (APP_PROG_ADDRESS + offset + sizeof(buff)) > sectorEndAddress )
+				/* a msg which is the only one missing in its parity group is restored,
+				 * only the rest of missing msgs are sent again, then 0xCC again */
+				GroupSeqRecover(rxBuff, &i_buff);
+
+				/* byte4..5 - block length, needed if the last msg can be restored */
+				if ( !blockCrcMode && (CAN_RxMsg_0x56x.length >= 6) )
 				{
+					i_buff = CAN_RxMsg_0x56x.data[4] | (CAN_RxMsg_0x56x.data[5] << 8);
+					if (i_buff > ProgBlockSize()){i_buff = ProgBlockSize();}
+				}
 
-					if (flash_EraseSector(sectorNbr) != FLASH_RDY)
+				if (GroupSeqMissing())
+				{
+					Status = 0xB3;
+					CAN_TxMsg_0x550.onetime_transmit = 1;
+					break;
+				}
+				checksum = BlockChecksum();
+			}
+
+			/* CRC32 mode: byte4..7 - CRC32 of the whole block padded with 0xFF, checksum is not used */
+			if (blockCrcMode && rxBlockAccept && (blockIdx == rxBlockIdx))
+			{
+				uint32_t crc = CAN_RxMsg_0x56x.data[4] | (CAN_RxMsg_0x56x.data[5] << 8)
+						| (CAN_RxMsg_0x56x.data[6] << 16) | ((uint32_t)CAN_RxMsg_0x56x.data[7] << 24);
+				checksum_can = ( (CAN_RxMsg_0x56x.length >= 8) && (CrcCalc32((uint32_t)rxBuff, ProgBlockSize()) == crc) ) ? 0 : 1;
+				checksum = 0;
+			}
+
+			if (windowMode)
+			{
+				ackBlockIdx = blockIdx;
+				if ( (blockIdx < nextBlockIdx) || (GroupActive() && GroupBlockReceived(blockIdx)) )
+				{
+					SendWindowAck(0xB0);	// repeated block, previous ack was lost
+				}
+				else if ( !rxBlockAccept || (blockIdx != rxBlockIdx) )
+				{
+					SendWindowAck(0xB1);	// block after a lost or bad one, or no free buffer
+				}
+				else
+				{
+					rxBlockAccept = 0;
+					if ((uint8_t)(checksum + checksum_can) != 0)
 					{
-						flashNotErase = 1;
-						Error_status = FLASH_PGM_ERROR;
+						SendWindowAck(0xB1);	// host should go back to 'nextBlockIdx'
 					}
 					else
 					{
-						flashNotErase = 0;
-						sectorEndAddress += FLASH_SECTOR_SIZE;
-						sectorNbr++;
+						/* block is written by CheckStagedBlocks, reception goes on */
+						if (packMode){UnpackQueueRxBuffer(i_buff);}
+						else {ProgQueueRxBuffer((uint32_t)blockIdx * ProgBlockSize());}
+						downloadRxBytes += i_buff;
+						if (GroupActive()){nextBlockIdx = GroupMarkBlocks(blockIdx, 1, nextBlockIdx);}
+						else {nextBlockIdx = blockIdx + 1;}
+						SendWindowAck(0xB0);
 					}
 				}
+				break;
+			}
 
+			if ( rxBlockAccept && ((uint8_t)(checksum + checksum_can) == 0) )
+			{
+				/* 'CANLoader' waits for the answer before the next block,
+				 * so it is sent by CheckStagedBlocks when the block is written */
+				rxBlockAccept = 0;
+				ProgQueueRxBuffer((uint32_t)rxBlockIdx * ProgBlockSize());
+				downloadRxBytes += i_buff;
+				nextBlockIdx++;
+				break;
+			}
 
-				if ( ( flashNotErase == 0) && ( (flashWrite(APP_PROG_ADDRESS + offset, ((uint32_t)buff), sizeof(buff))) == FLASH_RDY ) )
-				{
-					offset += sizeof(buff);
-					Status = 0xB0;
-				}
-				else {Error_status = FLASH_PGM_ERROR;}
+			/* checksum error or no free staging buffer: host sends this block again,
+			 * written blocks and erased sectors are kept */
+			Status = 0xB1;
+			checksum = 0;
+			rxBlockAccept = 0;
+			CAN_TxMsg_0x550.onetime_transmit = 1;
+			break;
 
+		case 0xBC: // skip/fill: byte1..2 - first block, byte3..4 - number of blocks, byte5 - fill byte (0xFF if absent)
+			if ( packMode || ProgFailed() ){break;}
+			rxBlockAccept = 0;
+			blockIdx = windowMode ? (CAN_RxMsg_0x56x.data[1] | (CAN_RxMsg_0x56x.data[2] << 8)) : nextBlockIdx;
+			uint8_t fill = (CAN_RxMsg_0x56x.length >= 6) ? CAN_RxMsg_0x56x.data[5] : 0xFF;
+			uint8_t skipStatus = SkipBlocks(blockIdx, CAN_RxMsg_0x56x.data[3] | (CAN_RxMsg_0x56x.data[4] << 8), fill);
+
+			if (windowMode){SendWindowAck(skipStatus);}
+			else
+			{
+				Status = skipStatus;
+				CAN_TxMsg_0x550.onetime_transmit = 1;
 			}
-			 else {
-				//Status = 0xB1;
-				flashNotErase = 1;
-				offset = 0;
-				checksum = 0;
-				Error_status = FLASH_PGM_ERROR;
-				}
+			break;
 
-			CAN_TxMsg_0x550.onetime_transmit = 1;
+		case 0xBD: // image id for the journal: byte1..4 (CRC32 of the image), after start command
+			if (journalActive)
+			{
+				JournalSetId(CAN_RxMsg_0x56x.data[1] | (CAN_RxMsg_0x56x.data[2] << 8)
+						| (CAN_RxMsg_0x56x.data[3] << 16) | ((uint32_t)CAN_RxMsg_0x56x.data[4] << 24));
+			}
+
+			if (windowMode){SendWindowAck(journalActive ? 0xBD : 0xB1);}
+			else
+			{
+				Status = journalActive ? 0xBD : 0xB1;
+				CAN_TxMsg_0x550.onetime_transmit = 1;
+			}
+			break;
+
+		case 0xCD: // end of compressed stream, patch or group download, answer is sent when the image is written
+			if ( !(packMode || patchMode || GroupActive()) || ProgFailed() ){break;}
+			if ( GroupActive() && (nextBlockIdx < GroupBlocks()) )
+			{
+				ackBlockIdx = nextBlockIdx;
+				SendWindowAck(0xB1);	// host sends missing blocks first
+				break;
+			}
+			if (packMode){UnpackFinish();}
+			ProgFinish();
+			endPending = 1;
+			break;
+
+		case 0xAD: // activate inactive slot (A/B): banks are swapped and board is reset, again - rollback
+			if (SlotReady())
+			{
+				JournalStart(0);	// journal is about the running bank, nothing to resume after the swap
+				swapPending = 1;
+				SendWindowAck(0xAD);
+			}
+			else
+			{
+				SendWindowAck(0xB1);
+			}
 			break;
 
 		case 0xDD:
 				NVIC_SystemReset();
 				break;
 
+		case 0xE0: // CAN Rx statistics
+				SendRxStat();
+				break;
+
+		case 0xE2: // download statistics
+				SendDownloadStat();
+				break;
+
+		case 0xE4: // journal of the last download
+				SendJournal();
+				break;
+
+		case 0xE3: // CRC32 of blocks in flash: byte1..2 - first block, byte3..4 - number of blocks (0 - up to the end)
+				if ( (ProgPending() != 0) || flashBusy() )
+				{
+					/* reading a bank which is erased or programmed stalls the bus: answer 0xE3 without CRC32
+					 * (byte3 - 0), host asks again when the download is over */
+					hashEndBlock = hashNextBlock;
+					CAN_TxMsg_0x551.data[0] = 0xE3;
+					CAN_TxMsg_0x551.data[1] = CAN_RxMsg_0x56x.data[1];
+					CAN_TxMsg_0x551.data[2] = CAN_RxMsg_0x56x.data[2];
+					CAN_TxMsg_0x551.data[3] = 0;
+					headerTxMsg_0x551.DataLength = FDCAN_DLC_BYTES_4;
+					CAN_TxMsg_0x551.onetime_transmit = 1;
+					break;
+				}
+
+				hashBlockSize = ProgBlockSize();
+				hashNextBlock = CAN_RxMsg_0x56x.data[1] | (CAN_RxMsg_0x56x.data[2] << 8);
+				hashEndBlock = CAN_RxMsg_0x56x.data[3] | (CAN_RxMsg_0x56x.data[4] << 8);
+				if ( (hashEndBlock == 0) || ((hashNextBlock + hashEndBlock) > (APP_PROG_MAX_SIZE / hashBlockSize)) )
+				{
+					hashEndBlock = APP_PROG_MAX_SIZE / hashBlockSize;
+				}
+				else
+				{
+					hashEndBlock += hashNextBlock;
+				}
+				break;
+
+#ifdef FLASH_BENCHMARK
+		case 0xE1: // flash programming benchmark, erases FLASH_BENCH_SECTOR, refused if an application is there
+				if (!flashBusy()){SendFlashBench();}
+				break;
+#endif
+
 		case 0xEE: // ping
+				CAN_TxMsg_0x551.data[0] = 0;
+				CAN_TxMsg_0x551.data[1] = 0;
+				headerTxMsg_0x551.DataLength = FDCAN_DLC_BYTES_2;
 				CAN_TxMsg_0x551.onetime_transmit = 1;
 				default:
 				break;
@@ -445,14 +771,26 @@ void Actions_CAN_0x57x_received(void)
 {
 	enableJump = 0;
 
-	/* Program is sending by CAN-mesage with data length = 8 bytes */
-	if (i_buff <= (sizeof(buff) - PROG_MSG_LENGTH) )
+	if (!rxBlockAccept){return;}
+
+	/* Program is sending by CAN-mesage with data length = 8 bytes (PROG_MSG_LENGTH)
+	 * or by CAN-FD message with data length = 64 bytes (PROG_MSG_LENGTH_FD) */
+	uint8_t length = CAN_RxMsg_0x57x.length;
+
+	if (GroupSeqMode())
+	{
+		/* byte0 - sequence number, msg is placed by it, so lost msg doesn't shift the next ones */
+		GroupSeqReceive(rxBuff, CAN_RxMsg_0x57x.data, length, &i_buff);
+		return;
+	}
+
+	if ( (length <= PROG_MSG_LENGTH_FD) && (i_buff <= (ProgBlockSize() - length)) )
 	{
-		for(int i = 0; i < PROG_MSG_LENGTH; i++){
-			buff[i_buff+i] = CAN_RxMsg_0x57x.data[i];
+		for(int i = 0; i < length; i++){
+			rxBuff[i_buff+i] = CAN_RxMsg_0x57x.data[i];
 			checksum += CAN_RxMsg_0x57x.data[i];
 		}
-		i_buff += PROG_MSG_LENGTH;
+		i_buff += length;
 	}
 
 }
@@ -460,6 +798,504 @@ void Actions_CAN_0x57x_received(void)
 
 
 
+/* StartDownload -------------------------------------------------------------*/
+enum PROG_STATUS StartDownload(void)
+{
+	uint32_t imageSize = 0;
+	enum PROG_STATUS status;
+
+	/* byte1..4 of start command - image size (optional), flash sectors are erased in advance */
+	if (CAN_RxMsg_0x56x.length >= 5)
+	{
+		imageSize = CAN_RxMsg_0x56x.data[1] | (CAN_RxMsg_0x56x.data[2] << 8)
+				| (CAN_RxMsg_0x56x.data[3] << 16) | ((uint32_t)CAN_RxMsg_0x56x.data[4] << 24);
+	}
+
+	UdsStop();
+	status = ProgStart(imageSize);
+
+	/* byte5 of 0xAB: bit0 - compressed image, bit1 - patch (only changed blocks are sent),
+	 * bit2 - delta to the old image (image size is required), bit3 - CRC32 of block in 0xCC,
+	 * bit4..6 - block size PROG_BLOCK_SIZE << n, bit7 - image to the inactive slot (image size is required) */
+	uint8_t flags = (windowMode && (CAN_RxMsg_0x56x.length >= 6)) ? CAN_RxMsg_0x56x.data[5] : 0;
+	uint8_t blockShift = (flags >> 4) & 0x07;
+	uint8_t slot = (flags & 0x80) != 0;
+
+	blockCrcMode = (flags & 0x08) != 0;
+	flags &= 0x07;
+	swapPending = 0;
+
+	packMode = (flags & 0x01) || (flags & 0x04);
+	patchMode = !packMode && (flags & 0x02);
+	endPending = 0;
+	if (packMode){UnpackStart((flags & 0x04) ? UNPACK_DELTA : UNPACK_HEATSHRINK);}
+	if (patchMode){ProgSetPatchMode();}
+	if ( (flags & 0x04) && (status != PROG_ERROR) && (ProgSetDeltaMode() == PROG_ERROR) )
+	{
+		ProgAbort();
+		status = PROG_ERROR;
+	}
+
+	/* A/B: plain, compressed or group image only, the running image isn't touched. Slot image is up to
+	 * APP_SLOT_MAX_SIZE (ProgSetSlotMode), a bigger one is written over the slot (SlotReady) */
+	if ( slot && (status != PROG_ERROR) && (ProgSetSlotMode() == PROG_ERROR) )
+	{
+		ProgAbort();
+		status = PROG_ERROR;
+	}
+
+	/* bigger blocks only for plain image: compressed, patch, delta and group work with PROG_BLOCK_SIZE */
+	if ( (flags == 0) && !GroupActive() && (status != PROG_ERROR) )
+	{
+		ProgSetBlockSize(PROG_BLOCK_SIZE << blockShift);
+	}
+
+	/* group: only sequential image with size, blocks can come in any order */
+	if (GroupActive())
+	{
+		if ( (imageSize == 0) || (flags != 0) || (status == PROG_ERROR) )
+		{
+			ProgAbort();
+			status = PROG_ERROR;
+		}
+		GroupStart((status == PROG_ERROR) ? 0 : imageSize);
+		ProgSetSparseMode();
+	}
+
+	/* journal is started for any download, flash is not the same any more */
+	JournalStart(imageSize);
+	journalActive = (imageSize != 0) && !packMode && !patchMode && !GroupActive() && !slot && (status != PROG_ERROR);
+
+	downloadRxBytes = 0;
+	downloadTime = 0;
+	downloadActive = 1;
+
+	rxBuff = 0;
+	rxBlockAccept = 0;
+
+	return status;
+}
+/* End StartDownload ---------------------------------------------------------*/
+
+
+
+/* SlotReady -----------------------------------------------------------------*/
+uint8_t SlotReady(void)
+{
+	/* The last download (journal keeps its size over reset) was not bigger than BANK1 - otherwise
+	 * it is written over the slot, even if BANK2 isn't erased yet - and the slot can be activated */
+	journalRecordTypeDef *pRecord = JournalGet();
+
+	if ( (pRecord != 0) && (pRecord->imageSize > APP_SLOT_MAX_SIZE) ){return 0;}
+
+	return ProgSlotReady();
+}
+/* End SlotReady -------------------------------------------------------------*/
+
+
+
+/* ResumeDownload ------------------------------------------------------------*/
+enum PROG_STATUS ResumeDownload(void)
+{
+	/* sequential download which was interrupted goes on from the end of programmed area,
+	 * image id should be the same as in the journal (0xBD) */
+	uint32_t imageId = CAN_RxMsg_0x56x.data[1] | (CAN_RxMsg_0x56x.data[2] << 8)
+			| (CAN_RxMsg_0x56x.data[3] << 16) | ((uint32_t)CAN_RxMsg_0x56x.data[4] << 24);
+	journalRecordTypeDef *pRecord = JournalGet();
+	uint32_t offset;
+
+	UdsStop();
+	packMode = 0;
+	patchMode = 0;
+	blockCrcMode = 0;
+	endPending = 0;
+	journalActive = 0;
+	rxBuff = 0;
+	rxBlockAccept = 0;
+
+	if ( (CAN_RxMsg_0x56x.length < 5) || (pRecord == 0) || (imageId == 0) || (pRecord->imageId != imageId)
+			|| (pRecord->committed == 0) || (pRecord->committed >= pRecord->imageSize) )
+	{
+		ProgAbort();
+		return PROG_ERROR;
+	}
+
+	offset = ProgResume(pRecord->imageSize, pRecord->committed, pRecord->head);
+	nextBlockIdx = offset / PROG_BLOCK_SIZE;
+	journalActive = 1;
+
+	downloadRxBytes = 0;
+	downloadTime = 0;
+	downloadActive = 1;
+
+	return PROG_IDLE;
+}
+/* End ResumeDownload --------------------------------------------------------*/
+
+
+
+/* CheckStagedBlocks ---------------------------------------------------------*/
+void CheckStagedBlocks(void)
+{
+	uint8_t packFree = UnpackFreeBuffers();
+
+	/* UDS download is programmed and answered by UdsProcess */
+	if (UdsActive()){return;}
+
+	/* compressed blocks are decoded to staging buffers */
+	if (packMode && !ProgFailed())
+	{
+		if (UnpackProcess() == PROG_ERROR)
+		{
+			ProgAbort();
+			Error_status = FLASH_PGM_ERROR;
+			SendWindowAck(0);
+			return;
+		}
+
+		if ( (UnpackFreeBuffers() > packFree) && !CAN_TxMsg_0x550.onetime_transmit ){SendWindowAck(0xB2);}
+	}
+
+	if ( endPending && (!packMode || UnpackDone()) && (ProgPending() == 0) && !ProgFailed()
+			&& !CAN_TxMsg_0x550.onetime_transmit )
+	{
+		endPending = 0;
+		downloadActive = 0;
+		SendWindowAck(0xCD);
+	}
+
+	/* erase and programming of staged blocks go on in background, CAN is serviced meanwhile */
+	enum PROG_STATUS progStatus = ProgProcess();
+
+	if ( journalActive && !ProgFailed() ){JournalCommit(ProgCommitted(), ProgGetHead());}
+
+	switch (progStatus)
+	{
+		case PROG_BLOCK_WRITTEN:
+			if (windowMode)
+			{
+				/* tell host that a staging buffer is free, if no other answer is pending */
+				if ( !packMode && !CAN_TxMsg_0x550.onetime_transmit ){SendWindowAck(0xB2);}
+			}
+			else
+			{
+				Status = 0xB0;
+				CAN_TxMsg_0x550.onetime_transmit = 1;
+			}
+			break;
+
+		case PROG_ERROR:
+			Error_status = FLASH_PGM_ERROR;
+			if (windowMode){SendWindowAck(0);}
+			else
+			{
+				Status = 0;
+				CAN_TxMsg_0x550.onetime_transmit = 1;
+			}
+			break;
+
+		case PROG_IDLE:
+		case PROG_BUSY:
+		default:
+			break;
+	}
+}
+/* End CheckStagedBlocks -----------------------------------------------------*/
+
+
+
+/* SkipBlocks ----------------------------------------------------------------*/
+uint8_t SkipBlocks(uint16_t blockIdx, uint16_t count, uint8_t fill)
+{
+	/* Blocks of one byte value are not sent by host. Erased pattern (0xFF) is only skipped,
+	 * other pattern (and 0xFF in patch mode, where old data is kept) is queued as filled blocks.
+	 * Blocks are filled while staging buffers are free, the answer tells how far it went,
+	 * host sends 0xBC again for the rest. Returns status of the answer */
+	if ( (blockIdx != nextBlockIdx) && !((patchMode || GroupActive()) && (blockIdx > nextBlockIdx)) ){return 0xB1;}
+	if ( (count == 0) || (((uint32_t)blockIdx + count) * ProgBlockSize() > APP_PROG_MAX_SIZE) ){return 0xB1;}
+	if ( GroupActive() && ((blockIdx + count) > GroupBlocks()) ){return 0xB1;}
+	ackBlockIdx = blockIdx;
+
+	if ( (fill == 0xFF) && !patchMode )
+	{
+		ProgSkip((uint32_t)blockIdx * ProgBlockSize(), (uint32_t)count * ProgBlockSize());
+		if (GroupActive()){nextBlockIdx = GroupMarkBlocks(blockIdx, count, nextBlockIdx);}
+		else {nextBlockIdx = blockIdx + count;}
+		return 0xB0;
+	}
+
+	/* 'CANLoader' mode: every written block is answered, so only 0xFF can be skipped there */
+	if (!windowMode){return 0xB1;}
+
+	uint8_t *pBuff;
+	while ( (count > 0) && ((pBuff = ProgGetRxBuffer()) != 0) )
+	{
+		if ( !(GroupActive() && GroupBlockReceived(blockIdx)) )
+		{
+			memset(pBuff, fill, ProgBlockSize());
+			ProgQueueRxBuffer((uint32_t)blockIdx * ProgBlockSize());
+		}
+		if (GroupActive()){nextBlockIdx = GroupMarkBlocks(blockIdx, 1, nextBlockIdx);}
+		else {nextBlockIdx = blockIdx + 1;}
+		blockIdx++;
+		count--;
+	}
+
+	return 0xB0;
+}
+/* End SkipBlocks ------------------------------------------------------------*/
+
+
+
+/* BlockAcceptable -----------------------------------------------------------*/
+uint8_t BlockAcceptable(uint16_t blockIdx)
+{
+	/* windowed download: blocks are written strictly in order, block after a bad one is dropped
+	 * until host goes back to 'nextBlockIdx' */
+
+	/* group: any block which is not received yet, lost ones are sent again later */
+	if (GroupActive()){return (blockIdx >= nextBlockIdx) && (blockIdx < GroupBlocks()) && !GroupBlockReceived(blockIdx);}
+
+	/* patch: unchanged blocks are skipped, so index can jump forward */
+	if (patchMode){return (blockIdx >= nextBlockIdx);}
+
+	return (blockIdx == nextBlockIdx);
+}
+/* End BlockAcceptable -------------------------------------------------------*/
+
+
+
+/* CheckIsoTpMessage ---------------------------------------------------------*/
+void CheckIsoTpMessage(void)
+{
+	/* ISO-TP msg: UDS request (uds.c), 0xBE - block of windowed download (byte1..2 - block index,
+	 * then program bytes), otherwise the same command as msg 0x56x. Block waits in ISO-TP buffer while there is
+	 * no free staging buffer, so the next msg of host is held by FC WAIT */
+	uint32_t size;
+	uint8_t *pMsg = IsoTpGetMsg(&size);
+	uint16_t blockIdx;
+
+	IsoTpProcess();
+	UdsProcess();
+	if (pMsg == 0){return;}
+
+	if (UdsIsService(pMsg[0]))
+	{
+		if (!UdsRequest(pMsg, size)){return;}	// TransferData waits for a free staging buffer
+	}
+	else if ( (pMsg[0] == 0xBE) && windowMode && !ProgFailed() && (size >= 4) && ((size - 3) <= ProgBlockSize()) )
+	{
+		blockIdx = pMsg[1] | (pMsg[2] << 8);
+		ackBlockIdx = blockIdx;
+
+		if ( (blockIdx < nextBlockIdx) || (GroupActive() && GroupBlockReceived(blockIdx)) )
+		{
+			SendWindowAck(0xB0);	// repeated block, previous ack was lost
+		}
+		else if (!BlockAcceptable(blockIdx))
+		{
+			SendWindowAck(0xB1);
+		}
+		else
+		{
+			rxBuff = packMode ? UnpackGetRxBuffer() : ProgGetRxBuffer();
+			if (rxBuff == 0){return;}
+
+			rxBlockAccept = 0;
+			i_buff = size - 3;
+			memset(rxBuff, 0xFF, ProgBlockSize());
+			memcpy(rxBuff, &pMsg[3], i_buff);
+
+			if (packMode){UnpackQueueRxBuffer(i_buff);}
+			else {ProgQueueRxBuffer((uint32_t)blockIdx * ProgBlockSize());}
+			downloadRxBytes += i_buff;
+			if (GroupActive()){nextBlockIdx = GroupMarkBlocks(blockIdx, 1, nextBlockIdx);}
+			else {nextBlockIdx = blockIdx + 1;}
+			SendWindowAck(0xB0);
+		}
+	}
+	else if ( (pMsg[0] != 0xBE) && (size <= sizeof(CAN_RxMsg_0x56x.data)) )
+	{
+		memcpy(CAN_RxMsg_0x56x.data, pMsg, size);
+		CAN_RxMsg_0x56x.length = size;
+		rxGroupCmd = 0;
+		Actions_CAN_0x56x_received();
+	}
+	else
+	{
+		SendWindowAck(0xB1);
+	}
+
+	IsoTpReleaseMsg();
+}
+/* End CheckIsoTpMessage -----------------------------------------------------*/
+
+
+
+/* BlockChecksum -------------------------------------------------------------*/
+uint8_t BlockChecksum(void)
+{
+	/* msgs with sequence number can come several times, so checksum is counted at the end of block */
+	uint8_t sum = 0;
+
+	for (uint32_t i = 0; i < i_buff; i++){sum += rxBuff[i];}
+
+	return sum;
+}
+/* End BlockChecksum ---------------------------------------------------------*/
+
+
+
+/* SendWindowAck -------------------------------------------------------------*/
+void SendWindowAck(uint8_t status)
+{
+	/* byte1..3 are filled in CheckTxMessageCAN1 with the state at the moment of sending */
+	Status = status;
+	CAN_TxMsg_0x550.onetime_transmit = 1;
+}
+/* End SendWindowAck ---------------------------------------------------------*/
+
+
+
+/* CheckSlotSwap -------------------------------------------------------------*/
+void CheckSlotSwap(void)
+{
+	/* answer 0xAD is on the bus, then option bytes are programmed and the new slot starts after reset */
+	if ( !swapPending || CAN_TxMsg_0x550.onetime_transmit || CAN1_TxPending() ){return;}
+
+	swapPending = 0;
+	if (flashSwapBanks() == FLASH_RDY){NVIC_SystemReset();}
+
+	Error_status = FLASH_PGM_ERROR;
+	SendWindowAck(0);
+}
+/* End CheckSlotSwap ---------------------------------------------------------*/
+
+
+
+#ifdef FLASH_BENCHMARK
+/* SendFlashBench ------------------------------------------------------------*/
+void SendFlashBench(void)
+{
+	typeDefFlashBench bench = {0};
+
+	/* FLASH_BENCH_SECTOR is in the application area: it is used only if no application is
+	 * installed (first flash word is erased) and no download is in progress, otherwise 0 cycles */
+	if ( (flashRead(APP_PROG_ADDRESS) == 0xFFFFFFFF) && (ProgPending() == 0) )
+	{
+		bench = flashBenchmark(FLASH_BENCH_SECTOR);
+	}
+
+	/* answer 0x551: byte0..3 - cycles of byte by byte write, byte4..7 - cycles of 64-bit write */
+	memcpy(&CAN_TxMsg_0x551.data[0], &bench.cyclesBytes, sizeof(uint32_t));
+	memcpy(&CAN_TxMsg_0x551.data[4], &bench.cyclesWide, sizeof(uint32_t));
+	headerTxMsg_0x551.DataLength = FDCAN_DLC_BYTES_8;
+	CAN_TxMsg_0x551.onetime_transmit = 1;
+}
+/* End SendFlashBench --------------------------------------------------------*/
+#endif
+
+
+
+/* CheckHashQuery ------------------------------------------------------------*/
+void CheckHashQuery(void)
+{
+	/* Answers to 0xE3 are sent one msg per call while half of Tx FIFO is free (the rest is for other answers):
+	 * 0xE3, byte1..2 - index of the first block, byte3 - number of CRC32 in msg, then CRC32 of blocks.
+	 * Classic CAN msg carries one CRC32, CAN-FD msg - 15.
+	 * Msg is put to Tx FIFO directly, not via 'CAN_TxMsg_0x551' which other answers fill meanwhile,
+	 * and the next block is taken only when the msg is queued. Flash isn't read while a download
+	 * started meanwhile erases or programs it, the answers go on after it */
+	FDCAN_TxHeaderTypeDef header = headerTxMsg_0x551;
+	uint8_t data[PROG_MSG_LENGTH_FD] = {0};
+	uint16_t block = hashNextBlock;
+	uint8_t number;
+	uint8_t maxNumber;
+
+	if (hashNextBlock >= hashEndBlock){return;}
+	if ( (ProgPending() != 0) || flashBusy() ){return;}
+	if ( CAN_TxMsg_0x551.onetime_transmit || (FDCAN_TxFifoFree(CAN_MODULE1) < (CAN_TX_FIFO_QUEUE_ELMTS_NBR / 2)) ){return;}
+
+	maxNumber = (header.FDFormat == FDCAN_FD_CAN) ? 15 : 1;
+
+	data[0] = 0xE3;
+	data[1] = (uint8_t)block;
+	data[2] = (uint8_t)(block >> 8);
+
+	for (number = 0; (number < maxNumber) && (block < hashEndBlock); number++, block++)
+	{
+		uint32_t crc = CrcCalc32(APP_PROG_ADDRESS + (uint32_t)block * hashBlockSize, hashBlockSize);
+		memcpy(&data[4 + number * 4], &crc, sizeof(crc));
+	}
+	data[3] = number;
+
+	header.DataLength = (maxNumber > 1) ? FDCAN_DLC_BYTES_64 : FDCAN_DLC_BYTES_8;
+	if (FDCAN_SendFifo(&header, data, CAN_MODULE1) == CAN_STATUS_OK){hashNextBlock = block;}
+}
+/* End CheckHashQuery --------------------------------------------------------*/
+
+
+
+/* SendJournal ---------------------------------------------------------------*/
+void SendJournal(void)
+{
+	/* answer 0x551: 0xE4, byte1..2 - blocks in flash, byte3..6 - image id, byte7 - 1 if journal is valid */
+	journalRecordTypeDef *pRecord = JournalGet();
+	uint16_t blocks = (pRecord != 0) ? (pRecord->committed / PROG_BLOCK_SIZE) : 0;
+	uint32_t imageId = (pRecord != 0) ? pRecord->imageId : 0;
+
+	CAN_TxMsg_0x551.data[0] = 0xE4;
+	CAN_TxMsg_0x551.data[1] = (uint8_t)blocks;
+	CAN_TxMsg_0x551.data[2] = (uint8_t)(blocks >> 8);
+	memcpy(&CAN_TxMsg_0x551.data[3], &imageId, sizeof(imageId));
+	CAN_TxMsg_0x551.data[7] = (pRecord != 0);
+	headerTxMsg_0x551.DataLength = FDCAN_DLC_BYTES_8;
+	CAN_TxMsg_0x551.onetime_transmit = 1;
+}
+/* End SendJournal -----------------------------------------------------------*/
+
+
+
+/* SendDownloadStat ----------------------------------------------------------*/
+void SendDownloadStat(void)
+{
+	/* answer 0x551: 0xE2, byte1..3 - program bytes received (compressed in compressed mode),
+	 * byte4..7 - ms since start command (until the end of stream in compressed mode) */
+	CAN_TxMsg_0x551.data[0] = 0xE2;
+	CAN_TxMsg_0x551.data[1] = (uint8_t)downloadRxBytes;
+	CAN_TxMsg_0x551.data[2] = (uint8_t)(downloadRxBytes >> 8);
+	CAN_TxMsg_0x551.data[3] = (uint8_t)(downloadRxBytes >> 16);
+	memcpy(&CAN_TxMsg_0x551.data[4], &downloadTime, sizeof(downloadTime));
+	headerTxMsg_0x551.DataLength = FDCAN_DLC_BYTES_8;
+	CAN_TxMsg_0x551.onetime_transmit = 1;
+}
+/* End SendDownloadStat ------------------------------------------------------*/
+
+
+
+/* SendRxStat ----------------------------------------------------------------*/
+void SendRxStat(void)
+{
+	typeDefCanRxStat rxStat = CAN1_GetRxStat();
+	typeDefCanTxStat txStat = CAN1_GetTxStat();
+
+	/* answer 0x551: 0xE0, lost msgs (FIFO full), ring full events, max FIFO fill level,
+	 * answers which waited because Tx FIFO was full */
+	CAN_TxMsg_0x551.data[0] = 0xE0;
+	CAN_TxMsg_0x551.data[1] = (uint8_t)rxStat.fifoLost;
+	CAN_TxMsg_0x551.data[2] = (uint8_t)(rxStat.fifoLost >> 8);
+	CAN_TxMsg_0x551.data[3] = (uint8_t)rxStat.ringFull;
+	CAN_TxMsg_0x551.data[4] = (uint8_t)(rxStat.ringFull >> 8);
+	CAN_TxMsg_0x551.data[5] = (uint8_t)rxStat.fifoMaxLevel;
+	CAN_TxMsg_0x551.data[6] = (uint8_t)txStat.fifoFull;
+	CAN_TxMsg_0x551.data[7] = (uint8_t)(txStat.fifoFull >> 8);
+	headerTxMsg_0x551.DataLength = FDCAN_DLC_BYTES_8;
+	CAN_TxMsg_0x551.onetime_transmit = 1;
+}
+/* End SendRxStat ------------------------------------------------------------*/
+
+
+
 
 
 
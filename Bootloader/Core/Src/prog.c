@@ -0,0 +1,879 @@
+/**
+  ******************************************************************************
+  * @file           : prog.c
+  * @brief          : Staging of received blocks and their programming to flash
+  ******************************************************************************
+  *
+  * Received blocks are kept in a ring of PROG_STAGE_BUFFERS buffers. Command 0xCC
+  * only queues the block, main loop writes queued blocks to flash one by one, so
+  * the next block is received to a free buffer while the previous one is still
+  * waiting or being programmed.
+  *
+  * Block size is PROG_BLOCK_SIZE unless host asks for a bigger one at start of
+  * windowed download (ProgSetBlockSize), up to a whole sector. Buffers are cut from
+  * 'stagePool' in AXI SRAM: 4 buffers up to 64K, 2 buffers of 128K.
+  *
+  * Erase and programming are non-blocking (flashSubmitErase, flashSubmitWrite),
+  * ProgProcess advances them and never waits for flash.
+  *
+  * Every bank has its own controller, so there is an operation per bank ('progState').
+  * ProgLanesNext gives every idle bank the oldest queued block for it: when blocks of
+  * both banks are staged (image crosses the bank boundary, blocks of group download
+  * interleaved by host), BANK1 and BANK2 are programmed at the same time, and erase
+  * of a sector goes on while the other bank is programmed. Written blocks are released
+  * in order of the queue. Patch, delta, slot copy and the first flash word use one bank
+  * at a time.
+  *
+  * If host announces image size at start, the sectors to erase are known: the first
+  * one is erased at once, the next one - when the current sector is half programmed,
+  * so erase goes on while the rest of the current sector is transferred. Without
+  * image size a sector is erased when the first block for it is to be written.
+  * Sectors are numbered through both banks (flash.c), so an image bigger than the
+  * rest of BANK1 goes on to BANK2 (Sector8) as if it was the next sector.
+  *
+  * Patch mode: host sends only changed blocks (see block CRC query in main.c). Sector
+  * with changed blocks is read to 'patchBuff' (128K in AXI SRAM), changed blocks are
+  * put there, then the sector is erased and programmed again as a whole. Sectors
+  * without changed blocks are not touched. Sector which is the same as in flash
+  * is not written.
+  *
+  * Delta mode is patch mode for an image which is rebuilt from the old one (delta.c):
+  * old data of a sector is copied to the scratch sector (the first sector after the
+  * new image) before the sector is erased, so delta can still refer to it. Old data
+  * of the previous sectors is lost.
+  *
+  * With known image size the first flash word of the image (stack pointer and
+  * reset vector) is programmed after the rest of the image, so an image which is
+  * not complete after reset is not started (CheckAppExist). Until then the word is
+  * kept in 'headWord' and in the journal (journal.c), so download can be resumed
+  * (ProgResume) from the end of programmed area.
+  *
+  * Slot mode (A/B update): image is written to BANK2 (inactive slot) at 'progBase',
+  * the running image in BANK1 stays intact. Before the image the bootloader and config
+  * sectors are copied to BANK2 if they differ, so the slot can boot after the banks are
+  * swapped (flashSwapBanks). Incomplete slot has no first flash word, it isn't activated.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "prog.h"
+#include <string.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static progStageTypeDef stage[PROG_STAGE_BUFFERS];
+static uint8_t stagePool[PROG_STAGE_POOL_SIZE] __ALIGNED(32);
+static uint8_t stageCount = PROG_STAGE_BUFFERS;	// buffers of 'blockSize' in 'stagePool'
+static uint32_t blockSize = PROG_BLOCK_SIZE;
+static uint32_t stageHead = 0;			// next buffer for reception
+static uint32_t stageTail = 0;			// next buffer for flash programming
+static uint8_t stageFlush;				// operation of a dropped download can still read its buffer
+
+static enum PROG_STATE progState[FLASH_BANKS];	// operation of every bank
+static uint32_t laneStage[FLASH_BANKS];	// block which is written to the bank, index in 'stage'
+
+static uint16_t flashNotErase;
+static uint8_t sectorNbr;				// next sector to erase
+static uint8_t sectorLast;				// last sector of the image, 0 - image size is unknown
+static uint32_t sectorEndAddress;		// last address of erased area (inclusive)
+static uint32_t progEndAddress;			// end of programmed area
+static uint32_t skipEndAddress;			// end of skipped area (0xBC), it is erased but not programmed
+static uint32_t imageEndAddress;		// 'progBase' + image size
+static uint32_t progBase = APP_PROG_ADDRESS;	// image address: APP_PROG_ADDRESS or the same sector of BANK2
+static uint8_t sectorFirst;				// sector of 'progBase'
+
+/* the first flash word of the image is programmed the last */
+static uint8_t headWord[NB_8BIT_IN_FLASHWORD] __ALIGNED(8);
+static uint8_t headHold;				// image size is known, block 0 is written without the first word
+static uint8_t headValid;				// 'headWord' should be programmed when the image is complete
+static uint8_t headAck;					// PROG_BLOCK_WRITTEN of the last block is returned when 'headWord' is written
+static uint8_t sparseMode;				// blocks come in any order, image is complete only at ProgFinish
+
+/* patch mode */
+static uint8_t patchMode = 0;
+static uint8_t patchBuff[FLASH_SECTOR_SIZE] __ALIGNED(8);
+static uint8_t patchSector = PROG_SECTOR_NONE;	// sector which is in 'patchBuff'
+static uint8_t patchErased;				// 'patchSector' is erased, 'patchBuff' should be programmed
+static uint8_t patchFlushing;			// 'patchSector' differs from flash, its erase and programming are started
+static uint8_t progFinish;				// no more blocks, the last sector of patch should be written
+
+/* delta mode */
+static uint8_t deltaMode = 0;
+static uint8_t scratchSector;			// copy of old data of 'backupSector'
+static uint8_t backupSector = PROG_SECTOR_NONE;
+static uint8_t scratchErased;
+static uint8_t liveSector;				// old data of sectors before it is erased
+
+/* slot mode */
+static uint8_t slotMode = 0;
+static uint8_t slotCopy;				// next sector of BANK1 before the image to copy to BANK2
+static uint8_t slotErased;				// BANK2 sector of 'slotCopy' is erased
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* ProgStart -----------------------------------------------------------------*/
+enum PROG_STATUS ProgStart(uint32_t imageSize)
+{
+	/* blocks of the previous download which are not written yet are dropped */
+	stageHead = 0;
+	stageTail = 0;
+	stageFlush = flashBusy();
+	memset(progState, PROG_ST_IDLE, sizeof(progState));
+	ProgSetBlockSize(PROG_BLOCK_SIZE);
+
+	flashNotErase = 0;
+
+	patchMode = 0;
+	patchSector = PROG_SECTOR_NONE;
+	patchErased = 0;
+	patchFlushing = 0;
+	progFinish = 0;
+
+	deltaMode = 0;
+	backupSector = PROG_SECTOR_NONE;
+	scratchErased = 0;
+	liveSector = FLASH_SECTOR_USER_PROG;
+
+	slotMode = 0;
+	progBase = APP_PROG_ADDRESS;
+	sectorFirst = FLASH_SECTOR_USER_PROG;
+
+	sectorNbr = FLASH_SECTOR_USER_PROG;
+	sectorEndAddress = ADDR_FLASH_SECTOR_2_BANK1 - 1;
+	progEndAddress = APP_PROG_ADDRESS;
+	skipEndAddress = APP_PROG_ADDRESS;
+	imageEndAddress = APP_PROG_ADDRESS + imageSize;
+
+	headHold = (imageSize != 0);
+	headValid = 0;
+	headAck = 0;
+	sparseMode = 0;
+
+	/* sectors are erased by ProgProcess */
+	sectorLast = 0;
+	if (imageSize == 0){return PROG_IDLE;}
+
+	if (imageSize > APP_PROG_MAX_SIZE)
+	{
+		ProgAbort();
+		return PROG_ERROR;
+	}
+
+	sectorLast = FLASH_SECTOR_USER_PROG + (imageSize - 1) / FLASH_SECTOR_SIZE;
+	return PROG_IDLE;
+}
+/* End ProgStart -------------------------------------------------------------*/
+
+
+
+/* ProgAbort -----------------------------------------------------------------*/
+void ProgAbort(void)
+{
+	/* nothing is written until the next ProgStart */
+	stageHead = stageTail;
+	stageFlush = flashBusy();
+	memset(progState, PROG_ST_IDLE, sizeof(progState));		// flash operations in progress are finished by flashProcess
+	flashNotErase = 1;
+}
+/* End ProgAbort -------------------------------------------------------------*/
+
+
+
+/* ProgSetPatchMode ----------------------------------------------------------*/
+void ProgSetPatchMode(void)
+{
+	/* called after ProgStart, blocks can come with gaps */
+	patchMode = 1;
+	headHold = 0;
+}
+/* End ProgSetPatchMode ------------------------------------------------------*/
+
+
+
+/* ProgSetSparseMode ---------------------------------------------------------*/
+void ProgSetSparseMode(void)
+{
+	/* called after ProgStart: blocks can come in any order (group download, missing blocks
+	 * are sent again later), so the first flash word is written only after ProgFinish */
+	sparseMode = 1;
+}
+/* End ProgSetSparseMode -----------------------------------------------------*/
+
+
+
+/* ProgSetDeltaMode ----------------------------------------------------------*/
+enum PROG_STATUS ProgSetDeltaMode(void)
+{
+	/* called after ProgStart with image size, the first sector after the image is scratch */
+	if ( (sectorLast == 0) || (sectorLast >= (FLASH_SECTORS_NBR - 1)) ){return PROG_ERROR;}
+
+	patchMode = 1;
+	headHold = 0;
+	deltaMode = 1;
+	scratchSector = sectorLast + 1;
+
+	return PROG_IDLE;
+}
+/* End ProgSetDeltaMode ------------------------------------------------------*/
+
+
+
+/* ProgSetSlotMode -----------------------------------------------------------*/
+enum PROG_STATUS ProgSetSlotMode(void)
+{
+	/* called after ProgStart with image size, before the first block: the image goes to
+	 * the inactive bank, so the first flash word keeps it from activation until it is complete.
+	 * Image should fit into one bank */
+	if ( (sectorLast == 0) || ((imageEndAddress - progBase) > APP_SLOT_MAX_SIZE) || patchMode ){return PROG_ERROR;}
+
+	slotMode = 1;
+	slotCopy = FLASH_SECTOR_BOOTLOADER;
+	slotErased = 0;
+
+	progBase += FLASH_BANK_SIZE;
+	sectorFirst += FLASH_SECTORS_BANK;
+	sectorNbr += FLASH_SECTORS_BANK;
+	sectorLast += FLASH_SECTORS_BANK;
+	sectorEndAddress += FLASH_BANK_SIZE;
+	progEndAddress += FLASH_BANK_SIZE;
+	skipEndAddress += FLASH_BANK_SIZE;
+	imageEndAddress += FLASH_BANK_SIZE;
+
+	return PROG_IDLE;
+}
+/* End ProgSetSlotMode -------------------------------------------------------*/
+
+
+
+/* ProgSlotReady -------------------------------------------------------------*/
+uint8_t ProgSlotReady(void)
+{
+	/* Inactive slot can be activated: nothing is programmed now, BANK2 has the same bootloader
+	 * and config sector and a complete image (its first flash word is written the last) */
+	uint8_t sector;
+
+	if ( (ProgPending() != 0) || flashBusy() || (slotMode && flashNotErase) ){return 0;}
+
+	for (sector = FLASH_SECTOR_BOOTLOADER; sector < FLASH_SECTOR_USER_PROG; sector++)
+	{
+		if (memcmp((uint8_t *)(uintptr_t)flash_SectorAddress(sector),
+				(uint8_t *)(uintptr_t)flash_SectorAddress(FLASH_SECTORS_BANK + sector), FLASH_SECTOR_SIZE) != 0){return 0;}
+	}
+
+	return (flashRead(APP_PROG_ADDRESS + FLASH_BANK_SIZE) != 0xFFFFFFFF);
+}
+/* End ProgSlotReady ---------------------------------------------------------*/
+
+
+
+/* ProgResume ----------------------------------------------------------------*/
+uint32_t ProgResume(uint32_t imageSize, uint32_t offset, uint8_t *pHead)
+{
+	/* Download goes on from 'offset' - end of area which was programmed before reset (journal).
+	 * The rest of its sector is used if it is still erased, otherwise the sector is written again.
+	 * 'pHead' - the first flash word, it isn't in flash yet. Returns offset of the next block */
+	uint32_t address;
+	uint32_t sectorAddress;
+
+	if ( (ProgStart(imageSize) == PROG_ERROR) || (offset == 0) || (offset >= imageSize) ){return 0;}
+
+	address = progBase + offset;
+	sectorAddress = flash_SectorAddress(flash_GetSector(address));
+
+	if ( (address != sectorAddress)
+			&& !flash_IsErasedPattern((uint8_t *)(uintptr_t)address, sectorAddress + FLASH_SECTOR_SIZE - address) )
+	{
+		address = sectorAddress;
+	}
+
+	/* sectors before 'address' are programmed, the next ones are erased as usual */
+	sectorNbr = flash_GetSector(sectorAddress);
+	sectorEndAddress = sectorAddress - 1;
+	if (address != sectorAddress)
+	{
+		sectorNbr++;
+		sectorEndAddress += FLASH_SECTOR_SIZE;
+	}
+	progEndAddress = address;
+
+	if (address == progBase){return 0;}
+
+	memcpy(headWord, pHead, sizeof(headWord));
+	headValid = 1;
+
+	return address - progBase;
+}
+/* End ProgResume ------------------------------------------------------------*/
+
+
+
+/* ProgCommitted -------------------------------------------------------------*/
+uint32_t ProgCommitted(void)
+{
+	/* end of area which is programmed (without the first flash word), sequential download only */
+	return progEndAddress - progBase;
+}
+/* End ProgCommitted ---------------------------------------------------------*/
+
+
+
+/* ProgGetHead ---------------------------------------------------------------*/
+uint8_t *ProgGetHead(void)
+{
+	/* the first flash word of the image if it is not programmed yet */
+	return headValid ? headWord : 0;
+}
+/* End ProgGetHead -----------------------------------------------------------*/
+
+
+
+/* ProgReadOld ---------------------------------------------------------------*/
+uint8_t ProgReadOld(uint32_t offset, uint8_t *pData)
+{
+	/* Delta mode: reads byte of the old image at 'offset' from APP_PROG_ADDRESS,
+	 * returns 0 if old data is already erased */
+	uint32_t address = progBase + offset;
+	uint8_t sector = flash_GetSector(address);
+
+	if (offset >= APP_PROG_MAX_SIZE){return 0;}
+
+	if (sector == backupSector)
+	{
+		address += (scratchSector - backupSector) * FLASH_SECTOR_SIZE;
+	}
+	else if ( (sector < liveSector) || (sector == scratchSector) )
+	{
+		return 0;
+	}
+
+	*pData = *(__IO uint8_t *)(uintptr_t)address;
+	return 1;
+}
+/* End ProgReadOld -----------------------------------------------------------*/
+
+
+
+/* ProgFinish ----------------------------------------------------------------*/
+void ProgFinish(void)
+{
+	progFinish = 1;
+}
+/* End ProgFinish ------------------------------------------------------------*/
+
+
+
+/* ProgSkip ------------------------------------------------------------------*/
+void ProgSkip(uint32_t offset, uint32_t size)
+{
+	/* Area of erased pattern is not queued, only its sectors are erased by ProgProcess */
+	if ( (progBase + offset + size) > skipEndAddress )
+	{
+		skipEndAddress = progBase + offset + size;
+	}
+}
+/* End ProgSkip --------------------------------------------------------------*/
+
+
+
+/* ProgSetBlockSize ----------------------------------------------------------*/
+uint32_t ProgSetBlockSize(uint32_t size)
+{
+	/* Called after ProgStart, before the first block. 'size' - PROG_BLOCK_SIZE << n,
+	 * a block never crosses a sector. Returns block size which is set */
+	if ( (size < PROG_BLOCK_SIZE) || (size > PROG_BLOCK_SIZE_MAX) || ((size & (size - 1)) != 0) ){size = PROG_BLOCK_SIZE;}
+	if (stageHead != stageTail){return blockSize;}
+
+	/* pool / size is 256 for the default size, it doesn't fit 'stageCount' before the limit */
+	blockSize = size;
+	stageCount = ( (PROG_STAGE_POOL_SIZE / size) > PROG_STAGE_BUFFERS ) ? PROG_STAGE_BUFFERS : (PROG_STAGE_POOL_SIZE / size);
+
+	for (uint8_t i = 0; i < stageCount; i++){stage[i].data = &stagePool[i * size];}
+
+	return blockSize;
+}
+/* End ProgSetBlockSize ------------------------------------------------------*/
+
+
+
+/* ProgBlockSize -------------------------------------------------------------*/
+uint32_t ProgBlockSize(void)
+{
+	return blockSize;
+}
+/* End ProgBlockSize ---------------------------------------------------------*/
+
+
+
+/* ProgGetRxBuffer -----------------------------------------------------------*/
+uint8_t *ProgGetRxBuffer(void)
+{
+	/* the same buffer is returned until it is queued by ProgQueueRxBuffer. After ProgStart/ProgAbort
+	 * no buffer is given until the operation of the dropped download is finished */
+	if (stageFlush){stageFlush = flashBusy();}
+	if ( stageFlush || ((stageHead - stageTail) >= stageCount) ){return 0;}
+
+	return stage[stageHead % stageCount].data;
+}
+/* End ProgGetRxBuffer -------------------------------------------------------*/
+
+
+
+/* ProgQueueRxBuffer ---------------------------------------------------------*/
+void ProgQueueRxBuffer(uint32_t offset)
+{
+	if ((stageHead - stageTail) >= stageCount){return;}
+
+	stage[stageHead % stageCount].offset = offset;
+	stage[stageHead % stageCount].state = PROG_STAGE_QUEUED;
+	stageHead++;
+}
+/* End ProgQueueRxBuffer -----------------------------------------------------*/
+
+
+
+/* ProgFreeBuffers -----------------------------------------------------------*/
+uint8_t ProgFreeBuffers(void)
+{
+	if (stageFlush){stageFlush = flashBusy();}
+	if (stageFlush){return 0;}
+
+	return (uint8_t)(stageCount - (stageHead - stageTail));
+}
+/* End ProgFreeBuffers -------------------------------------------------------*/
+
+
+
+/* ProgPending ---------------------------------------------------------------*/
+uint8_t ProgPending(void)
+{
+	/* blocks which are not in flash yet */
+	return (uint8_t)(stageHead - stageTail) + (patchSector != PROG_SECTOR_NONE) + headValid;
+}
+/* End ProgPending -----------------------------------------------------------*/
+
+
+
+/* ProgFailed ----------------------------------------------------------------*/
+uint8_t ProgFailed(void)
+{
+	return (flashNotErase != 0);
+}
+/* End ProgFailed ------------------------------------------------------------*/
+
+
+
+/* ProgProcess ---------------------------------------------------------------*/
+enum PROG_STATUS ProgProcess(void)
+{
+	/* Called from main loop: advances erase and programming of queued blocks in both banks */
+	enum FLASH_STATUS status = FLASH_RDY;
+	uint8_t blockWritten = 0;
+	uint8_t busy = 0;
+
+	for (uint32_t bank = 0; bank < FLASH_BANKS; bank++)
+	{
+		if (ProgLaneDone(bank, &blockWritten) != FLASH_RDY){status = FLASH_PGM_ERROR;}
+	}
+
+	/* next operations: operation of an aborted download can still be in progress */
+	if ( (status == FLASH_RDY) && !flashNotErase )
+	{
+		if ( slotMode && (slotCopy < FLASH_SECTOR_USER_PROG) )
+		{
+			/* bootloader and config sectors are copied before the image */
+			if ( !flashBusy() && ProgSlotCopyDue() ){status = ProgSlotCopyNext();}
+		}
+		else if (patchMode)
+		{
+			if (!flashBusy()){status = ProgPatchNext(&blockWritten);}
+		}
+		else if ( ProgHeadDue() && !ProgEraseDue() )
+		{
+			if (!flashBusy()){status = ProgSubmitWrite(PROG_ST_HEAD_WRITE, progBase, (uint32_t)(uintptr_t)headWord, sizeof(headWord));}
+		}
+		else
+		{
+			status = ProgLanesNext();
+			ProgReleaseBlocks(&blockWritten);		// blocks of erased flash words only are done without flash operation
+		}
+	}
+
+	if (status != FLASH_RDY)
+	{
+		/* the rest of the download is useless */
+		ProgAbort();
+		return PROG_ERROR;
+	}
+
+	if (blockWritten){return PROG_BLOCK_WRITTEN;}
+
+	for (uint32_t bank = 0; bank < FLASH_BANKS; bank++){busy |= (progState[bank] != PROG_ST_IDLE);}
+
+	return busy ? PROG_BUSY : PROG_IDLE;
+}
+/* End ProgProcess -----------------------------------------------------------*/
+
+
+
+/* ProgLaneDone --------------------------------------------------------------*/
+enum FLASH_STATUS ProgLaneDone(uint32_t bank, uint8_t *pBlockWritten)
+{
+	/* Advances operation of the bank, state is updated when it is completed */
+	enum FLASH_EVENT event = flashProcess(bank);
+	enum PROG_STATE state = progState[bank];
+
+	if ( (state == PROG_ST_IDLE) || (event == FLASH_EV_NONE) ){return FLASH_RDY;}
+	if (event == FLASH_EV_ERROR){return FLASH_PGM_ERROR;}
+
+	progState[bank] = PROG_ST_IDLE;
+
+	switch (state)
+	{
+		case PROG_ST_BACKUP_ERASE:
+			scratchErased = 1;
+			break;
+
+		case PROG_ST_BACKUP_WRITE:
+			scratchErased = 0;
+			backupSector = patchSector;
+			break;
+
+		case PROG_ST_SLOT_ERASE:
+			slotErased = 1;
+			break;
+
+		case PROG_ST_SLOT_WRITE:
+			slotErased = 0;
+			slotCopy++;
+			break;
+
+		case PROG_ST_ERASE:
+			if (patchMode){patchErased = 1; break;}
+
+			sectorEndAddress += FLASH_SECTOR_SIZE;
+			sectorNbr++;
+			break;
+
+		case PROG_ST_WRITE:
+			if (patchMode)
+			{
+				patchSector = PROG_SECTOR_NONE;
+				patchErased = 0;
+				patchFlushing = 0;
+				break;
+			}
+
+			stage[laneStage[bank] % stageCount].state = PROG_STAGE_WRITTEN;
+			ProgReleaseBlocks(pBlockWritten);
+			break;
+
+		case PROG_ST_HEAD_WRITE:
+			headValid = 0;
+			headHold = 0;
+			if (progEndAddress < imageEndAddress){progEndAddress = imageEndAddress;}	// image ends with skipped blocks
+			*pBlockWritten |= headAck;
+			headAck = 0;
+			break;
+
+		case PROG_ST_IDLE:
+		default:
+			break;
+	}
+
+	return FLASH_RDY;
+}
+/* End ProgLaneDone ----------------------------------------------------------*/
+
+
+
+/* ProgReleaseBlocks ---------------------------------------------------------*/
+void ProgReleaseBlocks(uint8_t *pBlockWritten)
+{
+	/* buffers are released in order, so programmed area has no gaps */
+	while ( (stageTail != stageHead) && (stage[stageTail % stageCount].state == PROG_STAGE_WRITTEN) )
+	{
+		if ( (progBase + stage[stageTail % stageCount].offset + blockSize) > progEndAddress )
+		{
+			progEndAddress = progBase + stage[stageTail % stageCount].offset + blockSize;
+		}
+		stageTail++;
+
+		/* the last block is reported when the first flash word is written too */
+		if (ProgHeadDue()){headAck = 1;}
+		else {*pBlockWritten = 1;}
+	}
+}
+/* End ProgReleaseBlocks -----------------------------------------------------*/
+
+
+
+/* ProgLanesNext -------------------------------------------------------------*/
+enum FLASH_STATUS ProgLanesNext(void)
+{
+	/* Plain image: planned erase first, then every idle bank takes the oldest queued block for it */
+	enum FLASH_STATUS status;
+	uint32_t address;
+	uint32_t eraseBank = sectorNbr / FLASH_SECTORS_BANK;	// bank of the next sector to erase
+	uint8_t eraseBusy[FLASH_BANKS];
+
+	for (uint32_t bank = 0; bank < FLASH_BANKS; bank++){eraseBusy[bank] = (progState[bank] == PROG_ST_ERASE);}
+
+	if ( ProgEraseDue() && !eraseBusy[eraseBank] && !flashBankBusy(eraseBank) )
+	{
+		status = ProgSubmitErase(PROG_ST_ERASE, sectorNbr);
+		if (status != FLASH_RDY){return status;}
+		eraseBusy[eraseBank] = 1;
+	}
+
+	for (uint32_t i = stageTail; i != stageHead; i++)
+	{
+		if (stage[i % stageCount].state != PROG_STAGE_QUEUED){continue;}
+
+		// if WriteData occupies not erased sector in Flash memory then clear this sector before writing
+		// sectors are erased one by one, so a block which comes after a gap (skip or sparse mode) erases the sectors before it too
+		address = progBase + stage[i % stageCount].offset;
+		if ( (address + blockSize - 1) > sectorEndAddress )
+		{
+			/* with known image size nothing is erased after its last sector */
+			if ( (sectorLast != 0) && (sectorNbr > sectorLast) ){return FLASH_PGM_ERROR;}
+			if ( !eraseBusy[eraseBank] && !flashBankBusy(eraseBank) )
+			{
+				status = ProgSubmitErase(PROG_ST_ERASE, sectorNbr);
+				if (status != FLASH_RDY){return status;}
+				eraseBusy[eraseBank] = 1;
+			}
+
+			/* the block waits for the erase, erased blocks of the other bank are programmed meanwhile */
+			continue;
+		}
+
+		if (flashBankBusy(flash_GetSector(address) / FLASH_SECTORS_BANK)){continue;}
+
+		status = ProgSubmitBlock(i);
+		if (status != FLASH_RDY){return status;}
+	}
+
+	return FLASH_RDY;
+}
+/* End ProgLanesNext ---------------------------------------------------------*/
+
+
+
+/* ProgSubmitErase -----------------------------------------------------------*/
+enum FLASH_STATUS ProgSubmitErase(enum PROG_STATE state, uint32_t sectorNumb)
+{
+	/* operation 'state' of the bank of the sector */
+	if (sectorNumb >= FLASH_SECTORS_NBR){return FLASH_PGM_ERROR;}
+
+	progState[sectorNumb / FLASH_SECTORS_BANK] = state;
+	return flashSubmitErase(sectorNumb);
+}
+/* End ProgSubmitErase -------------------------------------------------------*/
+
+
+
+/* ProgSubmitWrite -----------------------------------------------------------*/
+enum FLASH_STATUS ProgSubmitWrite(enum PROG_STATE state, uint32_t FlashAddress, uint32_t DataAddress, int DataSize)
+{
+	/* operation 'state' of the bank of 'FlashAddress' */
+	uint32_t sectorNumb = flash_GetSector(FlashAddress);
+
+	if (sectorNumb >= FLASH_SECTORS_NBR){return FLASH_PGM_ERROR;}
+
+	progState[sectorNumb / FLASH_SECTORS_BANK] = state;
+	return flashSubmitWrite(FlashAddress, DataAddress, DataSize);
+}
+/* End ProgSubmitWrite -------------------------------------------------------*/
+
+
+
+/* ProgEraseDue --------------------------------------------------------------*/
+uint8_t ProgEraseDue(void)
+{
+	if ( (sectorLast != 0) && (sectorNbr > sectorLast) ){return 0;}
+
+	/* skipped area isn't programmed, so its sectors are erased here even if image size is unknown */
+	if ( (skipEndAddress - 1) > sectorEndAddress ){return 1;}
+
+	/* planned erase: the first sector at once, the next one when the current sector is half programmed */
+	if (sectorLast == 0){return 0;}
+	if (sectorNbr == sectorFirst){return 1;}
+
+	return ( (progEndAddress + FLASH_SECTOR_SIZE / 2) > sectorEndAddress );
+}
+/* End ProgEraseDue ----------------------------------------------------------*/
+
+
+
+/* ProgHeadDue ---------------------------------------------------------------*/
+uint8_t ProgHeadDue(void)
+{
+	/* the first flash word is written when all blocks of the image are written or skipped */
+	if ( !headValid || (stageHead != stageTail) ){return 0;}
+	if (sparseMode){return progFinish;}
+
+	return (progEndAddress >= imageEndAddress) || (skipEndAddress >= imageEndAddress);
+}
+/* End ProgHeadDue -----------------------------------------------------------*/
+
+
+
+/* ProgSlotCopyDue -----------------------------------------------------------*/
+uint8_t ProgSlotCopyDue(void)
+{
+	/* slot mode: sectors of BANK1 before the image which differ in BANK2 are copied first */
+	if (!slotMode){return 0;}
+
+	while ( (slotCopy < FLASH_SECTOR_USER_PROG) && !slotErased
+			&& (memcmp((uint8_t *)(uintptr_t)flash_SectorAddress(slotCopy),
+					(uint8_t *)(uintptr_t)flash_SectorAddress(FLASH_SECTORS_BANK + slotCopy), FLASH_SECTOR_SIZE) == 0) )
+	{
+		slotCopy++;
+	}
+
+	return (slotCopy < FLASH_SECTOR_USER_PROG);
+}
+/* End ProgSlotCopyDue -------------------------------------------------------*/
+
+
+
+/* ProgSlotCopyNext ----------------------------------------------------------*/
+enum FLASH_STATUS ProgSlotCopyNext(void)
+{
+	/* BANK1 is read while BANK2 is programmed */
+	if (!slotErased)
+	{
+		return ProgSubmitErase(PROG_ST_SLOT_ERASE, FLASH_SECTORS_BANK + slotCopy);
+	}
+
+	return ProgSubmitWrite(PROG_ST_SLOT_WRITE, flash_SectorAddress(FLASH_SECTORS_BANK + slotCopy), flash_SectorAddress(slotCopy),
+			FLASH_SECTOR_SIZE);
+}
+/* End ProgSlotCopyNext ------------------------------------------------------*/
+
+
+
+/* ProgSubmitBlock -----------------------------------------------------------*/
+enum FLASH_STATUS ProgSubmitBlock(uint32_t stageIdx)
+{
+	/* block 'stageIdx' is in erased area, its bank is idle.
+	 * Flash words of 0xFF at both ends of the block (padding, gaps between sections) are already
+	 * in erased flash, so they are not programmed. Block of 0xFF only is written without flash operation */
+	progStageTypeDef *pStage = &stage[stageIdx % stageCount];
+	uint32_t address = progBase + pStage->offset;
+	uint32_t first = 0;
+	uint32_t end = blockSize;
+
+	if ( headHold && (pStage->offset == 0) )
+	{
+		memcpy(headWord, pStage->data, sizeof(headWord));
+		headValid = 1;
+		first = sizeof(headWord);
+	}
+
+	while ( (first < end) && flash_IsErasedPattern(&pStage->data[first], NB_8BIT_IN_FLASHWORD) ){first += NB_8BIT_IN_FLASHWORD;}
+	while ( (end > first) && flash_IsErasedPattern(&pStage->data[end - NB_8BIT_IN_FLASHWORD], NB_8BIT_IN_FLASHWORD) )
+	{
+		end -= NB_8BIT_IN_FLASHWORD;
+	}
+
+	if (first == end)
+	{
+		pStage->state = PROG_STAGE_WRITTEN;
+		return FLASH_RDY;
+	}
+
+	pStage->state = PROG_STAGE_WRITE;
+	laneStage[flash_GetSector(address) / FLASH_SECTORS_BANK] = stageIdx;
+
+	return ProgSubmitWrite(PROG_ST_WRITE, address + first, ((uint32_t)(uintptr_t)pStage->data + first), end - first);
+}
+/* End ProgSubmitBlock -------------------------------------------------------*/
+
+
+
+/* ProgPatchNext -------------------------------------------------------------*/
+enum FLASH_STATUS ProgPatchNext(uint8_t *pBlockTaken)
+{
+	/* Patch mode, flash is idle: puts the next queued block to 'patchBuff' or starts
+	 * erase and programming of 'patchSector' when the next block is in another sector */
+	uint32_t address;
+	uint32_t sectorAddress;
+	uint8_t sector;
+
+	if (patchErased)
+	{
+		return ProgSubmitWrite(PROG_ST_WRITE, flash_SectorAddress(patchSector), (uint32_t)(uintptr_t)patchBuff, sizeof(patchBuff));
+	}
+
+	if (stageHead != stageTail)
+	{
+		address = progBase + stage[stageTail % stageCount].offset;
+		sector = flash_GetSector(address);
+		sectorAddress = flash_SectorAddress(sector);
+
+		if ( (address + blockSize) > (progBase + APP_PROG_MAX_SIZE) ){return FLASH_PGM_ERROR;}
+
+		if ( (patchSector != PROG_SECTOR_NONE) && (sector != patchSector) ){return ProgPatchFlush();}
+
+		if (patchSector == PROG_SECTOR_NONE)
+		{
+			/* blocks which are not sent are kept as they are in flash,
+			 * in delta mode the whole new image is sent, rest of the last sector is empty */
+			if (deltaMode){memset(patchBuff, 0xFF, sizeof(patchBuff));}
+			else {memcpy(patchBuff, (uint8_t *)(uintptr_t)sectorAddress, sizeof(patchBuff));}
+			patchSector = sector;
+		}
+
+		memcpy(&patchBuff[address - sectorAddress], stage[stageTail % stageCount].data, blockSize);
+		stageTail++;
+		*pBlockTaken = 1;
+		return FLASH_RDY;
+	}
+
+	if ( progFinish && (patchSector != PROG_SECTOR_NONE) ){return ProgPatchFlush();}
+
+	return FLASH_RDY;
+}
+/* End ProgPatchNext ---------------------------------------------------------*/
+
+
+
+/* ProgPatchFlush ------------------------------------------------------------*/
+enum FLASH_STATUS ProgPatchFlush(void)
+{
+	/* Next step of writing 'patchBuff' to 'patchSector', flash is idle */
+	uint32_t sectorAddress = flash_SectorAddress(patchSector);
+
+	if (!patchFlushing)
+	{
+		if (memcmp(patchBuff, (uint8_t *)(uintptr_t)sectorAddress, sizeof(patchBuff)) == 0)
+		{
+			patchSector = PROG_SECTOR_NONE;		// sector is not changed
+			return FLASH_RDY;
+		}
+		patchFlushing = 1;
+	}
+
+	if ( deltaMode && (backupSector != patchSector) )
+	{
+		/* old data of the sector is copied to scratch sector, the previous copy is lost */
+		if (!scratchErased)
+		{
+			backupSector = PROG_SECTOR_NONE;
+			liveSector = patchSector;
+			return ProgSubmitErase(PROG_ST_BACKUP_ERASE, scratchSector);
+		}
+
+		return ProgSubmitWrite(PROG_ST_BACKUP_WRITE, flash_SectorAddress(scratchSector), sectorAddress, FLASH_SECTOR_SIZE);
+	}
+
+	liveSector = patchSector + 1;
+	return ProgSubmitErase(PROG_ST_ERASE, patchSector);
+}
+/* End ProgPatchFlush --------------------------------------------------------*/
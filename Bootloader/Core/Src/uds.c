@@ -0,0 +1,410 @@
+/**
+  ******************************************************************************
+  * @file           : uds.c
+  * @brief          : UDS (ISO 14229) download services on ISO-TP
+  ******************************************************************************
+  *
+  * Services: DiagnosticSessionControl (0x10), ECUReset (0x11), RoutineControl
+  * (0x31: eraseMemory 0xFF00, checkMemory 0x0202), RequestDownload (0x34),
+  * TransferData (0x36), RequestTransferExit (0x37), TesterPresent (0x3E).
+  *
+  * maxNumberOfBlockLength of RequestDownload is one staging buffer (prog.c) with
+  * SID and block sequence counter, so every TransferData is one staging buffer and
+  * is answered as soon as it is queued, while flash programming goes on. If there is
+  * no free staging buffer, TransferData stays in the ISO-TP buffer and the next one
+  * is held by ISO-TP flow control. Sectors are erased in background as in the other
+  * downloads, eraseMemory only starts it. RequestTransferExit is answered by
+  * responsePending and then positively when the last block is written.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "uds.h"
+#include "crc.h"
+#include "journal.h"
+#include <string.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static enum UDS_STATE udsState = UDS_ST_IDLE;
+static uint8_t udsActive = 0;			// download is driven by UDS, main loop doesn't answer blocks
+static uint8_t udsFailed = 0;			// programming error, the rest of download is answered negatively
+static uint32_t udsSize;				// memorySize of RequestDownload or eraseMemory
+static uint32_t udsOffset;				// bytes received by TransferData
+static uint8_t udsCounter;				// expected blockSequenceCounter
+
+static uint8_t udsTx[8];
+static uint8_t udsTxSize;
+static uint8_t udsTxPending = 0;
+static uint8_t udsResetPending = 0;
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* UdsIsService --------------------------------------------------------------*/
+uint8_t UdsIsService(uint8_t sid)
+{
+	/* UDS SIDs are not used by commands 0x56x, so both go on ISO-TP */
+	switch (sid)
+	{
+		case UDS_SID_SESSION_CONTROL:
+		case UDS_SID_ECU_RESET:
+		case UDS_SID_ROUTINE_CONTROL:
+		case UDS_SID_REQUEST_DOWNLOAD:
+		case UDS_SID_TRANSFER_DATA:
+		case UDS_SID_TRANSFER_EXIT:
+		case UDS_SID_TESTER_PRESENT:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+/* End UdsIsService ----------------------------------------------------------*/
+
+
+
+/* UdsRequest ----------------------------------------------------------------*/
+uint8_t UdsRequest(uint8_t *pMsg, uint32_t size)
+{
+	/* returns 0 if request should be given again later (no free staging buffer) */
+	uint8_t response[6];
+	uint8_t sub = (size >= 2) ? (pMsg[1] & ~UDS_SUPPRESS_RESPONSE) : 0;
+	uint8_t suppress = (size >= 2) && (pMsg[1] & UDS_SUPPRESS_RESPONSE);
+
+	switch (pMsg[0])
+	{
+		case UDS_SID_SESSION_CONTROL:
+			if (size != 2){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); break;}
+			if ( (sub < 0x01) || (sub > 0x03) ){UdsNegative(pMsg[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED); break;}
+
+			/* the same services in every session, timing: P2 and P2* (10 ms units) */
+			response[0] = pMsg[0] + UDS_POSITIVE_RESPONSE;
+			response[1] = sub;
+			response[2] = (uint8_t)(UDS_P2_SERVER_MAX >> 8);
+			response[3] = (uint8_t)UDS_P2_SERVER_MAX;
+			response[4] = (uint8_t)((UDS_P2X_SERVER_MAX / 10) >> 8);
+			response[5] = (uint8_t)(UDS_P2X_SERVER_MAX / 10);
+			if (!suppress){UdsRespond(response, 6);}
+			break;
+
+		case UDS_SID_ECU_RESET:
+			if (size != 2){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); break;}
+			if ( (sub != 0x01) && (sub != 0x03) ){UdsNegative(pMsg[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED); break;}
+
+			/* hard and soft reset are the same, reset is done when the answer is sent */
+			response[0] = pMsg[0] + UDS_POSITIVE_RESPONSE;
+			response[1] = sub;
+			if (!suppress){UdsRespond(response, 2);}
+			udsResetPending = 1;
+			break;
+
+		case UDS_SID_TESTER_PRESENT:
+			if (size != 2){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); break;}
+			if (sub != 0x00){UdsNegative(pMsg[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED); break;}
+
+			response[0] = pMsg[0] + UDS_POSITIVE_RESPONSE;
+			response[1] = 0x00;
+			if (!suppress){UdsRespond(response, 2);}
+			break;
+
+		case UDS_SID_ROUTINE_CONTROL:
+			UdsRoutineControl(pMsg, size);
+			break;
+
+		case UDS_SID_REQUEST_DOWNLOAD:
+			UdsRequestDownload(pMsg, size);
+			break;
+
+		case UDS_SID_TRANSFER_DATA:
+			return UdsTransferData(pMsg, size);
+
+		case UDS_SID_TRANSFER_EXIT:
+			UdsTransferExit(pMsg, size);
+			break;
+
+		default:
+			UdsNegative(pMsg[0], UDS_NRC_SERVICE_NOT_SUPPORTED);
+			break;
+	}
+
+	return 1;
+}
+/* End UdsRequest ------------------------------------------------------------*/
+
+
+
+/* UdsRoutineControl ---------------------------------------------------------*/
+void UdsRoutineControl(uint8_t *pMsg, uint32_t size)
+{
+	uint8_t response[5];
+	uint16_t routine;
+	uint32_t address;
+	uint32_t length;
+	uint32_t crc;
+
+	if (size < 4){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); return;}
+	if ((pMsg[1] & ~UDS_SUPPRESS_RESPONSE) != UDS_ROUTINE_START){UdsNegative(pMsg[0], UDS_NRC_SUBFUNCTION_NOT_SUPPORTED); return;}
+
+	routine = (pMsg[2] << 8) | pMsg[3];
+	response[0] = pMsg[0] + UDS_POSITIVE_RESPONSE;
+	response[1] = UDS_ROUTINE_START;
+	response[2] = pMsg[2];
+	response[3] = pMsg[3];
+
+	switch (routine)
+	{
+		case UDS_ROUTINE_ERASE_MEMORY:
+			/* sectors of the area are erased by ProgProcess ahead of the data, as in the other downloads */
+			if (!UdsParseAddress(&pMsg[4], size - 4, &address, &length)){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); return;}
+			if ( (address != APP_PROG_ADDRESS) || (length == 0) ){UdsNegative(pMsg[0], UDS_NRC_REQUEST_OUT_OF_RANGE); return;}
+			if (ProgStart(length) == PROG_ERROR){UdsNegative(pMsg[0], UDS_NRC_REQUEST_OUT_OF_RANGE); return;}
+			JournalStart(length);	// flash is not the same any more, an image bigger than BANK1 overwrites the slot
+
+			udsActive = 1;
+			udsFailed = 0;
+			udsSize = length;
+			udsState = UDS_ST_ERASE;
+			response[4] = 0x00;
+			break;
+
+		case UDS_ROUTINE_CHECK_MEMORY:
+			/* CRC32 of the image padded with 0xFF to 4 bytes, big-endian; routine status 0 - correct, 1 - wrong */
+			if (size != 8){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); return;}
+			if ( (udsSize == 0) || (udsState == UDS_ST_DOWNLOAD) || (udsState == UDS_ST_EXIT) || ProgPending() )
+			{
+				UdsNegative(pMsg[0], UDS_NRC_REQUEST_SEQUENCE_ERROR);
+				return;
+			}
+
+			crc = ((uint32_t)pMsg[4] << 24) | (pMsg[5] << 16) | (pMsg[6] << 8) | pMsg[7];
+			response[4] = (CrcCalc32(APP_PROG_ADDRESS, (udsSize + 3) & ~3U) == crc) ? 0x00 : 0x01;
+			break;
+
+		default:
+			UdsNegative(pMsg[0], UDS_NRC_REQUEST_OUT_OF_RANGE);
+			return;
+	}
+
+	UdsRespond(response, 5);
+}
+/* End UdsRoutineControl -----------------------------------------------------*/
+
+
+
+/* UdsRequestDownload --------------------------------------------------------*/
+void UdsRequestDownload(uint8_t *pMsg, uint32_t size)
+{
+	/* dataFormatIdentifier (0x00 - not compressed, not encrypted), addressAndLengthFormatIdentifier,
+	 * memoryAddress (APP_PROG_ADDRESS), memorySize */
+	uint8_t response[4];
+	uint32_t address;
+	uint32_t length;
+	uint32_t blockLength;
+
+	if ( (size < 3) || !UdsParseAddress(&pMsg[2], size - 2, &address, &length) )
+	{
+		UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH);
+		return;
+	}
+	if ( (pMsg[1] != 0x00) || (address != APP_PROG_ADDRESS) || (length == 0) || (length > APP_PROG_MAX_SIZE) )
+	{
+		UdsNegative(pMsg[0], UDS_NRC_REQUEST_OUT_OF_RANGE);
+		return;
+	}
+
+	/* erase of the same area can be started by eraseMemory */
+	if ( !((udsState == UDS_ST_ERASE) && (udsSize == length) && !ProgFailed()) )
+	{
+		if (ProgStart(length) == PROG_ERROR){UdsNegative(pMsg[0], UDS_NRC_DOWNLOAD_NOT_ACCEPTED); return;}
+		JournalStart(length);
+	}
+
+	udsActive = 1;
+	udsFailed = 0;
+	udsSize = length;
+	udsOffset = 0;
+	udsCounter = 1;
+	udsState = UDS_ST_DOWNLOAD;
+
+	/* maxNumberOfBlockLength: SID, counter and one staging buffer of the block size which is granted,
+	 * it is not bigger than UDS_BLOCK_SIZE, so TransferData fits ISO-TP buffer */
+	blockLength = ProgSetBlockSize(UDS_BLOCK_SIZE) + 2;
+
+	/* lengthFormatIdentifier: 2 bytes of maxNumberOfBlockLength */
+	response[0] = pMsg[0] + UDS_POSITIVE_RESPONSE;
+	response[1] = 0x20;
+	response[2] = (uint8_t)(blockLength >> 8);
+	response[3] = (uint8_t)blockLength;
+	UdsRespond(response, 4);
+}
+/* End UdsRequestDownload ----------------------------------------------------*/
+
+
+
+/* UdsTransferData -----------------------------------------------------------*/
+uint8_t UdsTransferData(uint8_t *pMsg, uint32_t size)
+{
+	/* blockSequenceCounter, then data: every block except the last one is one staging buffer */
+	uint8_t response[2];
+	uint32_t length = size - 2;
+	uint32_t blockSize = ProgBlockSize();
+	uint8_t *pBuff;
+
+	if (udsState != UDS_ST_DOWNLOAD){UdsNegative(pMsg[0], UDS_NRC_REQUEST_SEQUENCE_ERROR); return 1;}
+	if (size < 3){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); return 1;}
+	if ( udsFailed || ProgFailed() ){UdsNegative(pMsg[0], UDS_NRC_PROGRAMMING_FAILURE); return 1;}
+
+	response[0] = pMsg[0] + UDS_POSITIVE_RESPONSE;
+	response[1] = pMsg[1];
+
+	/* repeated block, the previous answer was lost */
+	if ( (udsOffset != 0) && (pMsg[1] == (uint8_t)(udsCounter - 1)) )
+	{
+		UdsRespond(response, 2);
+		return 1;
+	}
+	if (pMsg[1] != udsCounter){UdsNegative(pMsg[0], UDS_NRC_WRONG_BLOCK_COUNTER); return 1;}
+
+	if ( (length > blockSize) || ((udsOffset + length) > udsSize)
+			|| ((length != blockSize) && ((udsOffset + length) != udsSize)) )
+	{
+		UdsNegative(pMsg[0], UDS_NRC_REQUEST_OUT_OF_RANGE);
+		return 1;
+	}
+
+	pBuff = ProgGetRxBuffer();
+	if (pBuff == 0){return 0;}
+
+	memset(pBuff, 0xFF, blockSize);
+	memcpy(pBuff, &pMsg[2], length);
+	ProgQueueRxBuffer(udsOffset);
+	udsOffset += length;
+	udsCounter++;
+
+	UdsRespond(response, 2);
+	return 1;
+}
+/* End UdsTransferData -------------------------------------------------------*/
+
+
+
+/* UdsTransferExit -----------------------------------------------------------*/
+void UdsTransferExit(uint8_t *pMsg, uint32_t size)
+{
+	uint8_t response[3];
+
+	if (udsState != UDS_ST_DOWNLOAD){UdsNegative(pMsg[0], UDS_NRC_REQUEST_SEQUENCE_ERROR); return;}
+	if (size != 1){UdsNegative(pMsg[0], UDS_NRC_INCORRECT_LENGTH); return;}
+	if (udsOffset != udsSize){UdsNegative(pMsg[0], UDS_NRC_REQUEST_SEQUENCE_ERROR); return;}
+
+	/* the final answer is sent by UdsProcess when the image is written */
+	response[0] = UDS_SID_NEGATIVE_RESPONSE;
+	response[1] = pMsg[0];
+	response[2] = UDS_NRC_RESPONSE_PENDING;
+	UdsRespond(response, 3);
+	udsState = UDS_ST_EXIT;
+}
+/* End UdsTransferExit -------------------------------------------------------*/
+
+
+
+/* UdsProcess ----------------------------------------------------------------*/
+void UdsProcess(void)
+{
+	/* main loop: flash programming of UDS download, delayed answers and reset */
+	uint8_t response[1];
+
+	if ( udsActive && (ProgProcess() == PROG_ERROR) ){udsFailed = 1;}
+
+	if ( (udsState == UDS_ST_EXIT) && !udsTxPending && (udsFailed || (ProgPending() == 0)) )
+	{
+		udsState = UDS_ST_IDLE;
+		if (udsFailed){UdsNegative(UDS_SID_TRANSFER_EXIT, UDS_NRC_PROGRAMMING_FAILURE);}
+		else
+		{
+			response[0] = UDS_SID_TRANSFER_EXIT + UDS_POSITIVE_RESPONSE;
+			UdsRespond(response, 1);
+		}
+	}
+
+	if ( udsTxPending && IsoTpSend(udsTx, udsTxSize) ){udsTxPending = 0;}
+
+	if ( udsResetPending && !udsTxPending && !IsoTpTxBusy() ){NVIC_SystemReset();}
+}
+/* End UdsProcess ------------------------------------------------------------*/
+
+
+
+/* UdsActive -----------------------------------------------------------------*/
+uint8_t UdsActive(void)
+{
+	return udsActive;
+}
+/* End UdsActive -------------------------------------------------------------*/
+
+
+
+/* UdsStop -------------------------------------------------------------------*/
+void UdsStop(void)
+{
+	/* download is started by command 0x56x */
+	udsActive = 0;
+	udsState = UDS_ST_IDLE;
+}
+/* End UdsStop ---------------------------------------------------------------*/
+
+
+
+/* UdsParseAddress -----------------------------------------------------------*/
+uint8_t UdsParseAddress(uint8_t *pParam, uint32_t size, uint32_t *pAddress, uint32_t *pLength)
+{
+	/* addressAndLengthFormatIdentifier (bytes of size - high nibble, of address - low nibble),
+	 * then address and size, big-endian. Returns 0 if format is wrong */
+	uint8_t addressBytes = pParam[0] & 0x0F;
+	uint8_t lengthBytes = pParam[0] >> 4;
+
+	if ( (size == 0) || (addressBytes == 0) || (addressBytes > 4) || (lengthBytes == 0) || (lengthBytes > 4)
+			|| (size != (1U + addressBytes + lengthBytes)) ){return 0;}
+
+	*pAddress = 0;
+	for (uint8_t i = 0; i < addressBytes; i++){*pAddress = (*pAddress << 8) | pParam[1 + i];}
+
+	*pLength = 0;
+	for (uint8_t i = 0; i < lengthBytes; i++){*pLength = (*pLength << 8) | pParam[1 + addressBytes + i];}
+
+	return 1;
+}
+/* End UdsParseAddress -------------------------------------------------------*/
+
+
+
+/* UdsRespond ----------------------------------------------------------------*/
+void UdsRespond(uint8_t *pData, uint8_t size)
+{
+	/* single frame, it is sent by UdsProcess if ISO-TP is still sending the previous one */
+	if (udsTxPending && IsoTpSend(udsTx, udsTxSize)){udsTxPending = 0;}
+
+	memcpy(udsTx, pData, size);
+	udsTxSize = size;
+	udsTxPending = !IsoTpSend(udsTx, udsTxSize);
+}
+/* End UdsRespond ------------------------------------------------------------*/
+
+
+
+/* UdsNegative ---------------------------------------------------------------*/
+void UdsNegative(uint8_t sid, uint8_t nrc)
+{
+	uint8_t response[3];
+
+	response[0] = UDS_SID_NEGATIVE_RESPONSE;
+	response[1] = sid;
+	response[2] = nrc;
+	UdsRespond(response, 3);
+}
+/* End UdsNegative -----------------------------------------------------------*/
@@ -0,0 +1,281 @@
+/**
+  ******************************************************************************
+  * @file           : unpack.c
+  * @brief          : Streaming decompression of compressed image (heatshrink)
+  ******************************************************************************
+  *
+  * In compressed mode blocks 0xBB..0xCC carry heatshrink stream instead of raw
+  * program bytes. Received blocks wait in UNPACK_RX_BUFFERS buffers, UnpackProcess
+  * decodes them from main loop into staging buffers of prog.c, which are queued
+  * for flash programming as soon as they are full. Decoding stops while there is
+  * no free staging buffer and goes on later from the same bit.
+  *
+  * Stream format (heatshrink): tag bit 1 - literal byte (8 bits) follows,
+  * tag bit 0 - back-reference: distance-1 (UNPACK_WINDOW_BITS), count-1
+  * (UNPACK_LOOKAHEAD_BITS). Bits are MSB first.
+  *
+  * All buffers including the window are in .bss, i.e. in AXI SRAM (RAM_D1).
+  *
+  * The same way delta stream (delta.c) is decoded to the new image (UNPACK_DELTA).
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "unpack.h"
+#include "delta.h"
+#include <string.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static unpackRxTypeDef unpackRx[UNPACK_RX_BUFFERS];
+static uint32_t unpackHead = 0;			// next buffer for reception
+static uint32_t unpackTail = 0;			// next buffer for decoding
+static uint16_t unpackInPos;			// decoded bytes of 'unpackTail' buffer
+static uint8_t unpackFinish;			// end of stream, last partial block is written too
+static enum UNPACK_FORMAT unpackFormat;
+
+/* decoder */
+static uint8_t window[UNPACK_WINDOW_SIZE];
+static uint16_t windowHead;
+static enum UNPACK_STATE state;
+static uint32_t bitBuf;
+static uint8_t bitCount;
+static uint16_t brIndex;
+static uint16_t brCount;
+
+/* output */
+static uint8_t *outBuff;				// staging buffer which is filled now
+static uint16_t outLen;
+static uint32_t outOffset;				// offset of 'outBuff' from APP_PROG_ADDRESS
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* UnpackStart ---------------------------------------------------------------*/
+void UnpackStart(enum UNPACK_FORMAT format)
+{
+	unpackFormat = format;
+	DeltaStart();
+
+	unpackHead = 0;
+	unpackTail = 0;
+	unpackInPos = 0;
+	unpackFinish = 0;
+
+	memset(window, 0, sizeof(window));
+	windowHead = 0;
+	state = UNPACK_ST_TAG;
+	bitBuf = 0;
+	bitCount = 0;
+
+	outBuff = 0;
+	outLen = 0;
+	outOffset = 0;
+}
+/* End UnpackStart -----------------------------------------------------------*/
+
+
+
+/* UnpackFinish --------------------------------------------------------------*/
+void UnpackFinish(void)
+{
+	/* last partial block is queued when all received data is decoded */
+	unpackFinish = 1;
+}
+/* End UnpackFinish ----------------------------------------------------------*/
+
+
+
+/* UnpackGetRxBuffer ---------------------------------------------------------*/
+uint8_t *UnpackGetRxBuffer(void)
+{
+	if ((unpackHead - unpackTail) >= UNPACK_RX_BUFFERS){return 0;}
+
+	return unpackRx[unpackHead % UNPACK_RX_BUFFERS].data;
+}
+/* End UnpackGetRxBuffer -----------------------------------------------------*/
+
+
+
+/* UnpackQueueRxBuffer -------------------------------------------------------*/
+void UnpackQueueRxBuffer(uint16_t size)
+{
+	if ((unpackHead - unpackTail) >= UNPACK_RX_BUFFERS){return;}
+
+	unpackRx[unpackHead % UNPACK_RX_BUFFERS].size = size;
+	unpackHead++;
+}
+/* End UnpackQueueRxBuffer ---------------------------------------------------*/
+
+
+
+/* UnpackFreeBuffers ---------------------------------------------------------*/
+uint8_t UnpackFreeBuffers(void)
+{
+	return (uint8_t)(UNPACK_RX_BUFFERS - (unpackHead - unpackTail));
+}
+/* End UnpackFreeBuffers -----------------------------------------------------*/
+
+
+
+/* UnpackDone ----------------------------------------------------------------*/
+uint8_t UnpackDone(void)
+{
+	/* end of stream is received, decoded and passed to prog.c */
+	return ( unpackFinish && (unpackHead == unpackTail) && (outBuff == 0) );
+}
+/* End UnpackDone ------------------------------------------------------------*/
+
+
+
+/* UnpackOutSize -------------------------------------------------------------*/
+uint32_t UnpackOutSize(void)
+{
+	return outOffset + outLen;
+}
+/* End UnpackOutSize ---------------------------------------------------------*/
+
+
+
+/* UnpackProcess -------------------------------------------------------------*/
+enum PROG_STATUS UnpackProcess(void)
+{
+	/* Called from main loop: decodes received blocks while there are free staging buffers */
+	unpackRxTypeDef *pRx;
+	uint16_t len;
+
+	while (1)
+	{
+		if (outBuff == 0)
+		{
+			if ( (unpackHead == unpackTail) && !unpackFinish ){return PROG_IDLE;}
+			if (UnpackDone()){return PROG_IDLE;}
+
+			outBuff = ProgGetRxBuffer();
+			if (outBuff == 0){return PROG_BUSY;}		// wait for flash programming
+			memset(outBuff, 0xFF, PROG_BLOCK_SIZE);
+			outLen = 0;
+		}
+
+		if (unpackHead != unpackTail)
+		{
+			pRx = &unpackRx[unpackTail % UNPACK_RX_BUFFERS];
+
+			if (unpackFormat == UNPACK_DELTA)
+			{
+				unpackInPos += DeltaDecode(&pRx->data[unpackInPos], pRx->size - unpackInPos, &outBuff[outLen], PROG_BLOCK_SIZE - outLen, &len);
+				if (DeltaFailed()){return PROG_ERROR;}
+			}
+			else
+			{
+				unpackInPos += UnpackDecode(&pRx->data[unpackInPos], pRx->size - unpackInPos, &outBuff[outLen], PROG_BLOCK_SIZE - outLen, &len);
+			}
+			outLen += len;
+
+			if (unpackInPos >= pRx->size)
+			{
+				unpackTail++;
+				unpackInPos = 0;
+			}
+		}
+
+		/* full staging buffer or the last partial one are passed to flash programming */
+		if ( (outLen == PROG_BLOCK_SIZE) || (unpackFinish && (unpackHead == unpackTail)) )
+		{
+			if (outLen > 0)
+			{
+				if ((outOffset + PROG_BLOCK_SIZE) > APP_PROG_MAX_SIZE){return PROG_ERROR;}
+				ProgQueueRxBuffer(outOffset);
+				outOffset += PROG_BLOCK_SIZE;
+			}
+			outBuff = 0;
+			outLen = 0;
+		}
+		else if (unpackHead == unpackTail)
+		{
+			return PROG_IDLE;					// wait for next compressed block
+		}
+	}
+}
+/* End UnpackProcess ---------------------------------------------------------*/
+
+
+
+/* UnpackDecode --------------------------------------------------------------*/
+uint16_t UnpackDecode(const uint8_t *pIn, uint16_t inSize, uint8_t *pOut, uint16_t outSize, uint16_t *pOutLen)
+{
+	/* Decodes until input is over or output is full, returns number of used input bytes.
+	 * Decoder state is kept between calls, so stream can be split anywhere */
+	uint16_t inPos = 0;
+	uint16_t outPos = 0;
+	uint8_t bits = 0;
+	uint8_t byte;
+
+	while (1)
+	{
+		switch (state)
+		{
+			case UNPACK_ST_TAG:			bits = 1; break;
+			case UNPACK_ST_LITERAL:		bits = 8; break;
+			case UNPACK_ST_INDEX:		bits = UNPACK_WINDOW_BITS; break;
+			case UNPACK_ST_COUNT:		bits = UNPACK_LOOKAHEAD_BITS; break;
+			case UNPACK_ST_BACKREF:		bits = 0; break;
+		}
+
+		/* next field is taken only if output has room for it */
+		if ( (state == UNPACK_ST_LITERAL || state == UNPACK_ST_BACKREF) && (outPos >= outSize) ){break;}
+
+		while ( (bitCount < bits) && (inPos < inSize) )
+		{
+			bitBuf = (bitBuf << 8) | pIn[inPos++];
+			bitCount += 8;
+		}
+		if (bitCount < bits){break;}
+
+		bitCount -= bits;
+		uint16_t value = (uint16_t)((bitBuf >> bitCount) & ((1UL << bits) - 1));
+
+		switch (state)
+		{
+			case UNPACK_ST_TAG:
+				state = value ? UNPACK_ST_LITERAL : UNPACK_ST_INDEX;
+				break;
+
+			case UNPACK_ST_LITERAL:
+				byte = (uint8_t)value;
+				pOut[outPos++] = byte;
+				window[windowHead++ & (UNPACK_WINDOW_SIZE - 1)] = byte;
+				state = UNPACK_ST_TAG;
+				break;
+
+			case UNPACK_ST_INDEX:
+				brIndex = value + 1;
+				state = UNPACK_ST_COUNT;
+				break;
+
+			case UNPACK_ST_COUNT:
+				brCount = value + 1;
+				state = UNPACK_ST_BACKREF;
+				break;
+
+			case UNPACK_ST_BACKREF:
+				while ( (brCount > 0) && (outPos < outSize) )
+				{
+					byte = window[(uint16_t)(windowHead - brIndex) & (UNPACK_WINDOW_SIZE - 1)];
+					pOut[outPos++] = byte;
+					window[windowHead++ & (UNPACK_WINDOW_SIZE - 1)] = byte;
+					brCount--;
+				}
+				if (brCount == 0){state = UNPACK_ST_TAG;}
+				break;
+		}
+	}
+
+	*pOutLen = outPos;
+	return inPos;
+}
+/* End UnpackDecode ----------------------------------------------------------*/
@@ -41,6 +41,12 @@ defined in linker script */
 .word _sbss
 /* end address for the .bss section. defined in linker script */
 .word _ebss
+/* start address for the code of the .itcm section in flash. defined in linker script */
+.word _siitcm
+/* start address for the .itcm section in ITCMRAM. defined in linker script */
+.word _sitcm
+/* end address for the .itcm section in ITCMRAM. defined in linker script */
+.word _eitcm
 
 /**
  * @brief  This is the code that gets called when the processor first
@@ -77,6 +83,23 @@ LoopCopyDataInit:
   cmp r4, r1
   bcc CopyDataInit
 
+/* Copy the code which runs from ITCMRAM, main and interrupts use it */
+  ldr r0, =_sitcm
+  ldr r1, =_eitcm
+  ldr r2, =_siitcm
+  movs r3, #0
+  b LoopCopyItcmInit
+
+CopyItcmInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyItcmInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyItcmInit
+
 /* Zero fill the bss segment. */
   ldr r2, =_sbss
   ldr r4, =_ebss
@@ -0,0 +1,301 @@
+/**
+  ******************************************************************************
+  * @file           : bench_wire.c
+  * @brief          : Host benchmark of raw and compressed windowed download
+  ******************************************************************************
+  *
+  * The image is compressed with the heatshrink parameters of unpack.h and decoded
+  * back by UnpackDecode of unpack.c (round trip check). Then both downloads are
+  * laid out in classic CAN frames as in the windowed protocol (README.md):
+  * 0xAB + answer, per block 0xBB, msgs 0x570 of 8 bytes, 0xCC, answers 0xB0 and 0xB2,
+  * 0xCD + answer for the compressed stream. Every frame is counted with its exact
+  * stuff bits, CRC, ACK, EOF and intermission, so bus time is bits / bit rate at
+  * 500 kbit/s and 1 Mbit/s. Bus is assumed busy all the time (window is never
+  * empty, decoding and flash keep up with it), on the board compare with 0xE2.
+  *
+  * gcc -std=gnu11 -O2 -DSTM32H743xx -ICore/Inc -ICMSIS/Inc Test/bench_wire.c -o bench_wire && ./bench_wire app.bin
+  * (from Bootloader directory)
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "../Core/Src/unpack.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define BENCH_CMD_ID					(0x560U)
+#define BENCH_DATA_ID					(0x570U)
+#define BENCH_ANSWER_ID					(0x550U)
+#define BENCH_MSG_BYTES					(8U)		// program bytes per msg 0x570, classic CAN
+
+
+/* TypeDefines ---------------------------------------------------------------*/
+
+typedef struct
+{
+	uint32_t payload;					// bytes of blocks 0xBB..0xCC
+	uint32_t frames;
+	uint64_t bits;						// on the wire, stuff bits and intermission included
+}benchWireTypeDef;
+
+
+/* Delta and prog stubs (unpack.c is built in heatshrink mode only) ----------*/
+
+void DeltaStart(void){}
+uint8_t DeltaFailed(void){return 0;}
+
+uint16_t DeltaDecode(const uint8_t *pIn, uint16_t inSize, uint8_t *pOut, uint16_t outSize, uint16_t *pOutLen)
+{
+	(void)pIn; (void)inSize; (void)pOut; (void)outSize;
+	*pOutLen = 0;
+	return 0;
+}
+
+uint8_t *ProgGetRxBuffer(void){return 0;}
+void ProgQueueRxBuffer(uint32_t offset){(void)offset;}
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* BenchEncode ---------------------------------------------------------------*/
+static uint32_t BenchEncode(const uint8_t *pIn, uint32_t inSize, uint8_t *pOut)
+{
+	/* heatshrink stream: tag 1 + literal, tag 0 + distance-1 + count-1, MSB first.
+	 * Greedy longest match in the window, back-reference from 2 bytes (15 bits < 2 literals) */
+	uint32_t outBits = 0;
+	uint32_t pos = 0;
+	const uint32_t window = UNPACK_WINDOW_SIZE;
+	const uint32_t maxCount = 1U << UNPACK_LOOKAHEAD_BITS;
+
+	#define PUT_BITS(value, n) \
+		for (int b = (n) - 1; b >= 0; b--, outBits++) \
+		{ \
+			if ((outBits & 7) == 0){pOut[outBits >> 3] = 0;} \
+			if (((value) >> b) & 1){pOut[outBits >> 3] |= (uint8_t)(0x80 >> (outBits & 7));} \
+		}
+
+	while (pos < inSize)
+	{
+		uint32_t bestCount = 0;
+		uint32_t bestDist = 0;
+		uint32_t first = (pos > window) ? (pos - window) : 0;
+
+		for (uint32_t cand = pos; cand-- > first; )
+		{
+			uint32_t count = 0;
+			while ( (count < maxCount) && ((pos + count) < inSize) && (pIn[cand + count] == pIn[pos + count]) ){count++;}
+			if (count > bestCount){bestCount = count; bestDist = pos - cand;}
+			if (bestCount == maxCount){break;}
+		}
+
+		if (bestCount >= 2)
+		{
+			PUT_BITS(0U, 1);
+			PUT_BITS(bestDist - 1, UNPACK_WINDOW_BITS);
+			PUT_BITS(bestCount - 1, UNPACK_LOOKAHEAD_BITS);
+			pos += bestCount;
+		}
+		else
+		{
+			PUT_BITS(1U, 1);
+			PUT_BITS(pIn[pos], 8);
+			pos++;
+		}
+	}
+
+	#undef PUT_BITS
+	return (outBits + 7) / 8;
+}
+/* End BenchEncode -----------------------------------------------------------*/
+
+
+
+/* BenchCrc15 ----------------------------------------------------------------*/
+static uint16_t BenchCrc15(const uint8_t *pBits, uint32_t n)
+{
+	/* CAN CRC, polynomial 0x4599 */
+	uint16_t crc = 0;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint8_t next = pBits[i] ^ ((crc >> 14) & 1);
+		crc = (uint16_t)((crc << 1) & 0x7FFF);
+		if (next){crc ^= 0x4599;}
+	}
+	return crc;
+}
+/* End BenchCrc15 ------------------------------------------------------------*/
+
+
+
+/* BenchFrame ----------------------------------------------------------------*/
+static void BenchFrame(benchWireTypeDef *pWire, uint32_t id, const uint8_t *pData, uint8_t dlc)
+{
+	/* classic base frame: SOF..CRC are stuffed, then CRC delimiter, ACK, EOF and intermission (13 bits) */
+	uint8_t bits[19 + 64 + 15];
+	uint32_t n = 0;
+	uint32_t stuff = 0;
+	uint32_t run = 0;
+	uint8_t last = 2;
+	uint16_t crc;
+
+	bits[n++] = 0;												// SOF
+	for (int b = 10; b >= 0; b--){bits[n++] = (id >> b) & 1;}
+	bits[n++] = 0;												// RTR
+	bits[n++] = 0;												// IDE
+	bits[n++] = 0;												// r0
+	for (int b = 3; b >= 0; b--){bits[n++] = (dlc >> b) & 1;}
+	for (uint8_t i = 0; i < dlc; i++)
+	{
+		for (int b = 7; b >= 0; b--){bits[n++] = (pData[i] >> b) & 1;}
+	}
+	crc = BenchCrc15(bits, n);
+	for (int b = 14; b >= 0; b--){bits[n++] = (crc >> b) & 1;}
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		run = (bits[i] == last) ? (run + 1) : 1;
+		last = bits[i];
+		if (run == 5)
+		{
+			/* stuff bit of the other level starts the next run */
+			stuff++;
+			last = !last;
+			run = 1;
+		}
+	}
+
+	pWire->frames++;
+	pWire->bits += n + stuff + 13;
+}
+/* End BenchFrame ------------------------------------------------------------*/
+
+
+
+/* BenchDownload -------------------------------------------------------------*/
+static void BenchDownload(benchWireTypeDef *pWire, const uint8_t *pBlocks, uint32_t size, uint8_t compressed)
+{
+	/* windowed download of 'size' bytes in blocks of PROG_BLOCK_SIZE */
+	uint8_t msg[8] = {0};
+	uint32_t block = 0;
+
+	memset(pWire, 0, sizeof(*pWire));
+	pWire->payload = size;
+
+	msg[0] = 0xAB;
+	BenchFrame(pWire, BENCH_CMD_ID, msg, 6);
+	BenchFrame(pWire, BENCH_ANSWER_ID, msg, 4);
+
+	for (uint32_t offset = 0; offset < size; offset += PROG_BLOCK_SIZE, block++)
+	{
+		uint32_t len = ((size - offset) < PROG_BLOCK_SIZE) ? (size - offset) : PROG_BLOCK_SIZE;
+		uint8_t checksum = 0;
+
+		msg[0] = 0xBB; msg[1] = (uint8_t)block; msg[2] = (uint8_t)(block >> 8);
+		BenchFrame(pWire, BENCH_CMD_ID, msg, 3);
+
+		for (uint32_t i = 0; i < len; i += BENCH_MSG_BYTES)
+		{
+			uint8_t dlc = ((len - i) < BENCH_MSG_BYTES) ? (uint8_t)(len - i) : BENCH_MSG_BYTES;
+			BenchFrame(pWire, BENCH_DATA_ID, &pBlocks[offset + i], dlc);
+		}
+		for (uint32_t i = 0; i < len; i++){checksum += pBlocks[offset + i];}
+
+		msg[0] = 0xCC; msg[1] = checksum; msg[2] = (uint8_t)block; msg[3] = (uint8_t)(block >> 8);
+		BenchFrame(pWire, BENCH_CMD_ID, msg, 4);
+
+		/* 0xB0 - queued, 0xB2 - written (raw) or decoded (compressed) */
+		msg[0] = 0xB0; msg[1] = (uint8_t)(block + 1); msg[2] = (uint8_t)((block + 1) >> 8); msg[3] = 3;
+		BenchFrame(pWire, BENCH_ANSWER_ID, msg, 4);
+		msg[0] = 0xB2;
+		BenchFrame(pWire, BENCH_ANSWER_ID, msg, 4);
+	}
+
+	if (compressed)
+	{
+		msg[0] = 0xCD;
+		BenchFrame(pWire, BENCH_CMD_ID, msg, 1);
+		BenchFrame(pWire, BENCH_ANSWER_ID, msg, 4);
+	}
+}
+/* End BenchDownload ---------------------------------------------------------*/
+
+
+
+/* BenchPrint ----------------------------------------------------------------*/
+static void BenchPrint(const char *name, const benchWireTypeDef *pWire)
+{
+	printf("%-10s %9lu bytes %7lu frames %10llu bits  %8.2f s at 500 kbit/s  %8.2f s at 1 Mbit/s\n", name,
+			(unsigned long)pWire->payload, (unsigned long)pWire->frames, (unsigned long long)pWire->bits,
+			pWire->bits / 500000.0, pWire->bits / 1000000.0);
+}
+/* End BenchPrint ------------------------------------------------------------*/
+
+
+
+/* main ----------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+	FILE *file;
+	uint8_t *image;
+	uint8_t *packed;
+	uint8_t *unpacked;
+	uint32_t size;
+	uint32_t packedSize;
+	uint32_t inPos = 0;
+	uint32_t outPos = 0;
+	benchWireTypeDef raw;
+	benchWireTypeDef compressed;
+
+	if ( (argc < 2) || ((file = fopen(argv[1], "rb")) == 0) )
+	{
+		printf("usage: bench_wire app.bin\n");
+		return 2;
+	}
+	fseek(file, 0, SEEK_END);
+	size = (uint32_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	image = malloc(size + 1);
+	packed = malloc(size + size / 8 + 16);
+	unpacked = malloc(size + 1);
+	if ( (size == 0) || !image || !packed || !unpacked || (fread(image, 1, size, file) != size) ){return 2;}
+	fclose(file);
+
+	packedSize = BenchEncode(image, size, packed);
+
+	/* round trip with the decoder of the bootloader, stream is fed in blocks as on the bus */
+	UnpackStart(UNPACK_HEATSHRINK);
+	while ( (inPos < packedSize) && (outPos < size) )
+	{
+		uint16_t inLen = ((packedSize - inPos) < PROG_BLOCK_SIZE) ? (uint16_t)(packedSize - inPos) : PROG_BLOCK_SIZE;
+		uint16_t outLen;
+		uint16_t outRoom = ((size - outPos) < PROG_BLOCK_SIZE) ? (uint16_t)(size - outPos) : PROG_BLOCK_SIZE;
+		uint16_t used = UnpackDecode(&packed[inPos], inLen, &unpacked[outPos], outRoom, &outLen);
+
+		inPos += used;
+		outPos += outLen;
+		if ( (used == 0) && (outLen == 0) ){break;}
+	}
+	if ( (outPos != size) || (memcmp(image, unpacked, size) != 0) )
+	{
+		printf("FAIL: decoded stream differs from the image\n");
+		return 1;
+	}
+
+	BenchDownload(&raw, image, size, 0);
+	BenchDownload(&compressed, packed, packedSize, 1);
+
+	BenchPrint("raw", &raw);
+	BenchPrint("compressed", &compressed);
+	printf("compressed / raw: %.1f %% of bus time\n", 100.0 * compressed.bits / raw.bits);
+
+	return 0;
+}
+/* End main ------------------------------------------------------------------*/
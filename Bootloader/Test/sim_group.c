@@ -0,0 +1,307 @@
+/**
+  ******************************************************************************
+  * @file           : sim_group.c
+  * @brief          : Host simulation of group download with selective nack and parity
+  ******************************************************************************
+  *
+  * Blocks of PROG_BLOCK_SIZE are sent in msgs 0x57x with sequence number (classic CAN,
+  * 7 program bytes per msg) to several boards, every board loses every data and parity msg
+  * with the same probability, independently of the other boards. Commands and answers are
+  * not lost. Every board is the real group.c: its state is rebuilt from the msgs it has
+  * received, then 0xCC is handled as in main.c (GroupSeqRecover, GroupSeqMissing).
+  * Host sends again the union of the nack bitmaps 0xB3 of all boards, then 0xCC again,
+  * until every board has the block. Restored blocks are compared with the sent ones.
+  *
+  * Bus time counts every frame with its exact stuff bits, CRC, ACK, EOF and intermission:
+  * 0xBB, data and parity msgs, 0xCC, answer of every board to every 0xCC (0xB3 or 0xB0)
+  * and 0xB2 of every board per block. Flash is assumed to keep up with the bus.
+  *
+  * gcc -std=gnu11 -O2 -DSTM32H743xx -ICore/Inc -ICMSIS/Inc Test/sim_group.c -o sim_group && ./sim_group
+  * (from Bootloader directory)
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "../Core/Src/group.c"
+#include <stdio.h>
+
+
+/* Defines -------------------------------------------------------------------*/
+
+#define SIM_BLOCKS							(64U)		// image of 64K
+#define SIM_STRIDE							(PROG_MSG_LENGTH - 1U)	// program bytes per msg, byte0 - sequence number
+#define SIM_FRAMES							((PROG_BLOCK_SIZE + SIM_STRIDE - 1) / SIM_STRIDE)
+#define SIM_PARITY_GROUP					(8U)		// msgs per parity msg
+#define SIM_BOARDS_MAX						(16U)
+#define SIM_ROUNDS_MAX						(1000U)
+
+
+/* TypeDefines ---------------------------------------------------------------*/
+
+typedef struct
+{
+	uint64_t bits;						// on the wire, stuff bits and intermission included
+	uint32_t frames;
+	uint32_t rounds;					// 0xCC after the first one
+	uint32_t failures;					// blocks restored with wrong data
+}simStatTypeDef;
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static uint32_t simSeed = 1;
+static uint8_t simMsg[PROG_SEQ_FRAMES_MAX][PROG_MSG_LENGTH];	// data msgs, then parity msgs
+static uint8_t simLength[PROG_SEQ_FRAMES_MAX];
+static uint32_t simReceived[SIM_BOARDS_MAX][PROG_SEQ_FRAMES_MAX / 32];
+
+
+/* Prog stub (group.c asks for the block size) -------------------------------*/
+
+uint32_t ProgBlockSize(void){return PROG_BLOCK_SIZE;}
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* SimRandom -----------------------------------------------------------------*/
+static uint32_t SimRandom(void)
+{
+	/* xorshift32, the same sequence at every run */
+	simSeed ^= simSeed << 13;
+	simSeed ^= simSeed >> 17;
+	simSeed ^= simSeed << 5;
+	return simSeed;
+}
+/* End SimRandom -------------------------------------------------------------*/
+
+
+
+/* SimFrame ------------------------------------------------------------------*/
+static void SimFrame(simStatTypeDef *pStat, uint32_t id, const uint8_t *pData, uint8_t dlc)
+{
+	/* classic base frame: SOF..CRC are stuffed, then CRC delimiter, ACK, EOF and intermission (13 bits) */
+	uint8_t bits[19 + 64 + 15];
+	uint32_t n = 0;
+	uint32_t stuff = 0;
+	uint32_t run = 0;
+	uint8_t last = 2;
+	uint16_t crc = 0;
+
+	bits[n++] = 0;												// SOF
+	for (int b = 10; b >= 0; b--){bits[n++] = (id >> b) & 1;}
+	bits[n++] = 0;												// RTR
+	bits[n++] = 0;												// IDE
+	bits[n++] = 0;												// r0
+	for (int b = 3; b >= 0; b--){bits[n++] = (dlc >> b) & 1;}
+	for (uint8_t i = 0; i < dlc; i++)
+	{
+		for (int b = 7; b >= 0; b--){bits[n++] = (pData[i] >> b) & 1;}
+	}
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint8_t next = bits[i] ^ ((crc >> 14) & 1);
+		crc = (uint16_t)((crc << 1) & 0x7FFF);
+		if (next){crc ^= 0x4599;}
+	}
+	for (int b = 14; b >= 0; b--){bits[n++] = (crc >> b) & 1;}
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		run = (bits[i] == last) ? (run + 1) : 1;
+		last = bits[i];
+		if (run == 5)
+		{
+			stuff++;
+			last = !last;
+			run = 1;
+		}
+	}
+
+	pStat->frames++;
+	pStat->bits += n + stuff + 13;
+}
+/* End SimFrame --------------------------------------------------------------*/
+
+
+
+/* SimMakeBlock --------------------------------------------------------------*/
+static uint16_t SimMakeBlock(uint8_t *pBlock, uint8_t parityGroup)
+{
+	/* random block cut into msgs, parity msg n - XOR of msgs of group n padded with 0xFF.
+	 * Returns number of msgs (data and parity) */
+	uint16_t groups = parityGroup ? (SIM_FRAMES + parityGroup - 1) / parityGroup : 0;
+
+	for (uint32_t i = 0; i < PROG_BLOCK_SIZE; i++){pBlock[i] = (uint8_t)SimRandom();}
+
+	for (uint16_t seq = 0; seq < SIM_FRAMES; seq++)
+	{
+		uint32_t position = seq * SIM_STRIDE;
+		uint32_t size = ((PROG_BLOCK_SIZE - position) < SIM_STRIDE) ? (PROG_BLOCK_SIZE - position) : SIM_STRIDE;
+
+		simMsg[seq][0] = (uint8_t)seq;
+		memcpy(&simMsg[seq][1], &pBlock[position], size);
+		simLength[seq] = (uint8_t)(size + 1);
+	}
+
+	for (uint16_t n = 0; n < groups; n++)
+	{
+		uint8_t *pParity = simMsg[SIM_FRAMES + n];
+
+		pParity[0] = (uint8_t)(SIM_FRAMES + n);
+		memset(&pParity[1], 0, SIM_STRIDE);
+		for (uint16_t seq = n * parityGroup; (seq < (n + 1) * parityGroup) && (seq < SIM_FRAMES); seq++)
+		{
+			for (uint32_t i = 0; i < SIM_STRIDE; i++)
+			{
+				pParity[1 + i] ^= (i < (uint32_t)(simLength[seq] - 1)) ? simMsg[seq][1 + i] : 0xFF;
+			}
+		}
+		simLength[SIM_FRAMES + n] = PROG_MSG_LENGTH;
+	}
+
+	return SIM_FRAMES + groups;
+}
+/* End SimMakeBlock ----------------------------------------------------------*/
+
+
+
+/* SimBoardCheck -------------------------------------------------------------*/
+static uint8_t SimBoardCheck(uint32_t board, const uint8_t *pCmdBB, const uint8_t *pBlock, uint16_t msgs,
+		uint32_t *pNackMap, uint16_t *pNackBase, simStatTypeDef *pStat)
+{
+	/* board handles 0xCC with the msgs it has received, returns 1 if the block is complete */
+	uint8_t buff[PROG_BLOCK_SIZE];
+	uint32_t length = 0;
+	uint8_t base;
+
+	memset(buff, 0xFF, sizeof(buff));
+	GroupSeqStart(pCmdBB, 7);
+	for (uint16_t seq = 0; seq < msgs; seq++)
+	{
+		if (simReceived[board][seq / 32] & (1UL << (seq % 32))){GroupSeqReceive(buff, simMsg[seq], simLength[seq], &length);}
+	}
+	GroupSeqRecover(buff, &length);
+
+	if (GroupSeqMissing())
+	{
+		GroupSeqNack(&base, pNackMap);
+		*pNackBase = base;
+		return 0;
+	}
+
+	if (memcmp(buff, pBlock, PROG_BLOCK_SIZE) != 0){pStat->failures++;}
+	return 1;
+}
+/* End SimBoardCheck ---------------------------------------------------------*/
+
+
+
+/* SimDownload ---------------------------------------------------------------*/
+static void SimDownload(simStatTypeDef *pStat, uint32_t boards, double loss, uint8_t parityGroup)
+{
+	uint8_t block[PROG_BLOCK_SIZE];
+	uint8_t cmd[8] = {0};
+	uint8_t send[PROG_SEQ_FRAMES_MAX];
+	uint32_t lossLevel = (uint32_t)(loss * 4294967295.0);
+
+	memset(pStat, 0, sizeof(*pStat));
+
+	for (uint16_t blockIdx = 0; blockIdx < SIM_BLOCKS; blockIdx++)
+	{
+		uint16_t msgs = SimMakeBlock(block, parityGroup);
+		uint8_t cmdBB[7] = {0xBB, (uint8_t)blockIdx, (uint8_t)(blockIdx >> 8), 0x01, SIM_FRAMES, SIM_STRIDE, parityGroup};
+		uint8_t complete = 0;
+
+		memset(simReceived, 0, sizeof(simReceived));
+		memset(send, 1, msgs);
+		SimFrame(pStat, CAN_GROUP_CMD_ID, cmdBB, parityGroup ? 7 : 6);
+
+		for (uint32_t round = 0; !complete && (round < SIM_ROUNDS_MAX); round++)
+		{
+			for (uint16_t seq = 0; seq < msgs; seq++)
+			{
+				if (!send[seq]){continue;}
+				SimFrame(pStat, CAN_GROUP_DATA_ID, simMsg[seq], simLength[seq]);
+				for (uint32_t board = 0; board < boards; board++)
+				{
+					if (SimRandom() >= lossLevel){simReceived[board][seq / 32] |= (1UL << (seq % 32));}
+				}
+			}
+
+			/* 0xCC with block length, every board answers */
+			cmd[0] = 0xCC; cmd[2] = (uint8_t)blockIdx; cmd[3] = (uint8_t)(blockIdx >> 8);
+			cmd[4] = (uint8_t)PROG_BLOCK_SIZE; cmd[5] = (uint8_t)(PROG_BLOCK_SIZE >> 8);
+			SimFrame(pStat, CAN_GROUP_CMD_ID, cmd, 6);
+			if (round != 0){pStat->rounds++;}
+
+			memset(send, 0, sizeof(send));
+			complete = 1;
+			for (uint32_t board = 0; board < boards; board++)
+			{
+				uint32_t nackMap = 0;
+				uint16_t nackBase = 0;
+				uint8_t answer[8] = {0xB0};
+
+				if (SimBoardCheck(board, cmdBB, block, msgs, &nackMap, &nackBase, pStat))
+				{
+					SimFrame(pStat, CAN_GROUP_STATUS_ID + board, answer, 6);
+					continue;
+				}
+
+				answer[0] = 0xB3;
+				SimFrame(pStat, CAN_GROUP_STATUS_ID + board, answer, 8);
+				for (uint32_t i = 0; i < 32; i++)
+				{
+					if (nackMap & (1UL << i)){send[nackBase + i] = 1;}
+				}
+				complete = 0;
+			}
+		}
+
+		if (!complete){pStat->failures++;}
+
+		/* 0xB2 of every board when the block is written */
+		for (uint32_t board = 0; board < boards; board++)
+		{
+			uint8_t answer[6] = {0xB2};
+			SimFrame(pStat, CAN_GROUP_STATUS_ID + board, answer, 6);
+		}
+	}
+}
+/* End SimDownload -----------------------------------------------------------*/
+
+
+
+/* main ----------------------------------------------------------------------*/
+int main(void)
+{
+	static const uint32_t boardCount[] = {1, 4, 16};
+	static const double lossRate[] = {0.0, 0.001, 0.01, 0.05};
+	simStatTypeDef stat;
+	uint32_t failures = 0;
+
+	printf("%uK image, blocks of %u bytes, %u msgs 0x57x per block, parity: %u msgs per parity msg\n",
+			SIM_BLOCKS * PROG_BLOCK_SIZE / 1024, PROG_BLOCK_SIZE, SIM_FRAMES, SIM_PARITY_GROUP);
+	printf("boards  loss %%  parity    frames  resends      500 kbit/s    1 Mbit/s\n");
+
+	for (uint32_t b = 0; b < sizeof(boardCount) / sizeof(boardCount[0]); b++)
+	{
+		for (uint32_t l = 0; l < sizeof(lossRate) / sizeof(lossRate[0]); l++)
+		{
+			for (uint8_t parity = 0; parity <= SIM_PARITY_GROUP; parity += SIM_PARITY_GROUP)
+			{
+				simSeed = 1;
+				SimDownload(&stat, boardCount[b], lossRate[l], parity);
+				failures += stat.failures;
+				printf("%6u  %6.1f  %6s  %8u  %7u  %12.2f s  %8.2f s\n", boardCount[b], 100.0 * lossRate[l],
+						parity ? "yes" : "no", stat.frames, stat.rounds, stat.bits / 500000.0, stat.bits / 1000000.0);
+			}
+		}
+	}
+
+	if (failures != 0){printf("FAIL: %u blocks are not complete or restored with wrong data\n", failures);}
+	return (failures != 0);
+}
+/* End main ------------------------------------------------------------------*/
@@ -0,0 +1,265 @@
+/**
+  ******************************************************************************
+  * @file           : test_prog.c
+  * @brief          : Host test of sector erase planning in prog.c
+  ******************************************************************************
+  *
+  * prog.c is built for the host with the flash driver replaced by stubs below:
+  * every submitted operation is completed at the next flashProcess of its bank.
+  * Image is sent block by block, erased sectors are checked at the end.
+  *
+  * gcc -std=gnu11 -DSTM32H743xx -ICore/Inc -ICMSIS/Inc Test/test_prog.c -o test_prog && ./test_prog
+  * (from Bootloader directory)
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "../Core/Src/prog.c"
+#include <stdio.h>
+
+
+/* Variables -----------------------------------------------------------------*/
+
+static uint8_t stubBusy[FLASH_BANKS];
+static uint32_t stubErased;				// bit n - sector n was erased
+static uint32_t stubHeadWrites;			// writes of the first flash word
+static uint32_t stubWrittenBytes;		// bytes programmed by all writes
+static uint32_t failures = 0;
+
+
+/* Flash stubs ---------------------------------------------------------------*/
+
+enum FLASH_STATUS flashSubmitErase(uint32_t sectorNumb)
+{
+	if (sectorNumb >= FLASH_SECTORS_NBR){return FLASH_PGM_ERROR;}
+	if (stubBusy[sectorNumb / FLASH_SECTORS_BANK]){return FLASH_BUSY;}
+
+	stubBusy[sectorNumb / FLASH_SECTORS_BANK] = 1;
+	stubErased |= (1UL << sectorNumb);
+	return FLASH_RDY;
+}
+
+enum FLASH_STATUS flashSubmitWrite(uint32_t FlashAddress, uint32_t DataAddress, int DataSize)
+{
+	uint32_t sector = flash_GetSector(FlashAddress);
+
+	(void)DataAddress;
+	if ( (DataSize <= 0) || (sector >= FLASH_SECTORS_NBR) ){return FLASH_PGM_ERROR;}
+	if (stubBusy[sector / FLASH_SECTORS_BANK]){return FLASH_BUSY;}
+	if ((stubErased & (1UL << sector)) == 0){return FLASH_PGM_ERROR;}		// written before erase
+
+	if (FlashAddress == progBase){stubHeadWrites++;}
+	stubWrittenBytes += DataSize;
+	stubBusy[sector / FLASH_SECTORS_BANK] = 1;
+	return FLASH_RDY;
+}
+
+enum FLASH_EVENT flashProcess(uint32_t bank)
+{
+	if (!stubBusy[bank]){return FLASH_EV_NONE;}
+
+	stubBusy[bank] = 0;
+	return FLASH_EV_DONE;
+}
+
+uint8_t flashBusy(void){return stubBusy[0] || stubBusy[1];}
+uint8_t flashBankBusy(uint32_t bank){return stubBusy[bank];}
+uint32_t flashRead(uint32_t address){(void)address; return 0xFFFFFFFF;}
+
+uint8_t flash_IsErasedPattern(uint8_t *src_addr, uint32_t DataSize)
+{
+	/* flash of the host test is erased, RAM buffers are checked */
+	if ( ((uintptr_t)src_addr >= ADDR_FLASH_SECTOR_0_BANK1) && ((uintptr_t)src_addr <= FLASH_END) ){return 1;}
+
+	for (uint32_t i = 0; i < DataSize; i++)
+	{
+		if (src_addr[i] != 0xFF){return 0;}
+	}
+	return 1;
+}
+
+uint32_t flash_GetSector(uint32_t address)
+{
+	return (address - ADDR_FLASH_SECTOR_0_BANK1) / FLASH_SECTOR_SIZE;
+}
+
+uint32_t flash_SectorAddress(uint32_t sectorNumb)
+{
+	return ADDR_FLASH_SECTOR_0_BANK1 + sectorNumb * FLASH_SECTOR_SIZE;
+}
+
+
+/* Functions -----------------------------------------------------------------*/
+
+/* DownloadImage -------------------------------------------------------------*/
+static uint8_t DownloadImage(uint32_t imageSize)
+{
+	/* sequential download with image size, returns 0 if prog.c reported an error */
+	uint32_t offset = 0;
+	uint32_t loops = 0;
+
+	memset(stubBusy, 0, sizeof(stubBusy));
+	stubErased = 0;
+	stubHeadWrites = 0;
+
+	if (ProgStart(imageSize) == PROG_ERROR){return 0;}
+
+	while ( ((offset < imageSize) || (ProgPending() != 0)) && (loops++ < 1000000) )
+	{
+		uint8_t *pBuff = (offset < imageSize) ? ProgGetRxBuffer() : 0;
+
+		if (pBuff != 0)
+		{
+			memset(pBuff, 0x5A, ProgBlockSize());
+			ProgQueueRxBuffer(offset);
+			offset += ProgBlockSize();
+		}
+
+		if (ProgProcess() == PROG_ERROR){return 0;}
+	}
+
+	return (ProgPending() == 0) && (stubHeadWrites == 1);
+}
+/* End DownloadImage ---------------------------------------------------------*/
+
+
+
+/* Check ---------------------------------------------------------------------*/
+static void Check(const char *name, uint8_t ok)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+	if (!ok){failures++;}
+}
+/* End Check -----------------------------------------------------------------*/
+
+
+
+/* RestartWhileBusy ----------------------------------------------------------*/
+static uint8_t RestartWhileBusy(void)
+{
+	/* write of a dropped download reads its stage buffer: no buffer until the write is finished */
+	uint8_t *pBuff;
+
+	memset(stubBusy, 0, sizeof(stubBusy));
+	stubErased = 0;
+	ProgStart(FLASH_SECTOR_SIZE);
+	pBuff = ProgGetRxBuffer();
+	ProgQueueRxBuffer(0);
+	ProgProcess();							// erase of Sector2
+	ProgProcess();							// block 0 is written
+	if (!flashBankBusy(0)){return 0;}
+
+	ProgAbort();
+	ProgStart(FLASH_SECTOR_SIZE);
+	if ( (ProgGetRxBuffer() != 0) || (ProgFreeBuffers() != 0) ){return 0;}
+
+	flashProcess(0);
+	return (ProgGetRxBuffer() == pBuff) && (ProgFreeBuffers() != 0);
+}
+/* End RestartWhileBusy ------------------------------------------------------*/
+
+
+
+/* EraseOverlapsWrite --------------------------------------------------------*/
+static uint8_t EraseOverlapsWrite(void)
+{
+	/* block of Sector8 is queued before the last block of Sector7: Sector8 (BANK2) is erased
+	 * while the block of Sector7 (BANK1) is written */
+	uint8_t head[NB_8BIT_IN_FLASHWORD] = {0};
+	uint32_t sector7 = ADDR_FLASH_SECTOR_7_BANK1 - APP_PROG_ADDRESS;
+
+	memset(stubBusy, 0, sizeof(stubBusy));
+	stubErased = 0;
+	if (ProgResume(APP_PROG_MAX_SIZE, sector7, head) != sector7){return 0;}
+
+	ProgGetRxBuffer();
+	ProgQueueRxBuffer(ADDR_FLASH_SECTOR_0_BANK2 - APP_PROG_ADDRESS);
+	ProgGetRxBuffer();
+	ProgQueueRxBuffer(sector7);
+	ProgProcess();							// erase of Sector7
+	ProgProcess();							// erase of Sector8, block of Sector7 is written
+
+	return (progState[0] == PROG_ST_WRITE) && (progState[1] == PROG_ST_ERASE);
+}
+/* End EraseOverlapsWrite ----------------------------------------------------*/
+
+
+
+/* ErasedWordsSkipped --------------------------------------------------------*/
+static uint8_t ErasedWordsSkipped(void)
+{
+	/* block 0 ends with two flash words of 0xFF, block 1 is all 0xFF: only block 0 without
+	 * its first flash word (head) and its erased end is written, then the head */
+	uint8_t *pBuff;
+	uint32_t loops = 0;
+
+	memset(stubBusy, 0, sizeof(stubBusy));
+	stubErased = 0;
+	stubHeadWrites = 0;
+	stubWrittenBytes = 0;
+	if (ProgStart(2 * PROG_BLOCK_SIZE) == PROG_ERROR){return 0;}
+
+	pBuff = ProgGetRxBuffer();
+	memset(pBuff, 0x5A, PROG_BLOCK_SIZE - 2 * NB_8BIT_IN_FLASHWORD);
+	memset(&pBuff[PROG_BLOCK_SIZE - 2 * NB_8BIT_IN_FLASHWORD], 0xFF, 2 * NB_8BIT_IN_FLASHWORD);
+	ProgQueueRxBuffer(0);
+	pBuff = ProgGetRxBuffer();
+	memset(pBuff, 0xFF, PROG_BLOCK_SIZE);
+	ProgQueueRxBuffer(PROG_BLOCK_SIZE);
+
+	while ( (ProgPending() != 0) && (loops++ < 1000) )
+	{
+		if (ProgProcess() == PROG_ERROR){return 0;}
+	}
+
+	return (ProgPending() == 0) && (stubHeadWrites == 1)
+			&& (stubWrittenBytes == PROG_BLOCK_SIZE - 2 * NB_8BIT_IN_FLASHWORD);
+}
+/* End ErasedWordsSkipped ----------------------------------------------------*/
+
+
+
+/* SectorMask ----------------------------------------------------------------*/
+static uint32_t SectorMask(uint32_t first, uint32_t last)
+{
+	/* bits first..last */
+	return ((1UL << (last + 1)) - 1) & ~((1UL << first) - 1);
+}
+/* End SectorMask ------------------------------------------------------------*/
+
+
+
+/* main ----------------------------------------------------------------------*/
+int main(void)
+{
+	/* image which ends at the end of BANK1: BANK2 (the other A/B slot) isn't erased */
+	Check("768K image, end of Sector7", DownloadImage(APP_SLOT_MAX_SIZE)
+			&& (stubErased == SectorMask(Sector2, Sector7)));
+
+	/* image of the whole application area ends at the end of Sector15 */
+	Check("APP_PROG_MAX_SIZE image, end of Sector15", DownloadImage(APP_PROG_MAX_SIZE)
+			&& (stubErased == SectorMask(Sector2, Sector15)));
+
+	/* one sector */
+	Check("128K image, one sector", DownloadImage(FLASH_SECTOR_SIZE)
+			&& (stubErased == SectorMask(Sector2, Sector2)));
+
+	/* not a multiple of the sector size */
+	Check("128K + 1K image", DownloadImage(FLASH_SECTOR_SIZE + PROG_BLOCK_SIZE)
+			&& (stubErased == SectorMask(Sector2, Sector3)));
+
+	/* ProgStart after ProgAbort while the block is written */
+	Check("restart while block is written", RestartWhileBusy());
+
+	/* erase in one bank, programming in the other */
+	Check("erase of BANK2 overlaps write of BANK1", EraseOverlapsWrite());
+
+	/* erased flash words at the ends of blocks */
+	Check("flash words of 0xFF are not programmed", ErasedWordsSkipped());
+
+	return (failures != 0);
+}
+/* End main ------------------------------------------------------------------*/